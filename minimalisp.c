@@ -1,5 +1,13 @@
+/* posix_memalign, which unlike aligned_alloc is declared under -std=c99 */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "mpc.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 
@@ -24,6 +32,7 @@ void add_history(char* unused) {}
 /* Forward Declarations */
 
 mpc_parser_t* Number;
+mpc_parser_t* Decimal;
 mpc_parser_t* Symbol;
 mpc_parser_t* String;
 mpc_parser_t* Comment;
@@ -34,46 +43,465 @@ mpc_parser_t* Lispy;
 
 struct lval;
 struct lenv;
+struct lcode;
+struct lbuf;
+struct lstrbuf;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lbuf lbuf;
+typedef struct lstrbuf lstrbuf;
+
+/* Memory Pools */
+
+/* lval and lenv objects are carved out of slabs: aligned blocks of fixed  */
+/* size slots, so the slab owning any object is found by masking its      */
+/* address. Freed slots go on the pool's free list and are reused before  */
+/* a new slab is taken from the system.                                   */
+/*                                                                        */
+/* Each slab records which of its slots are in use and which have been    */
+/* marked, so the garbage collector can walk every object a pool owns.    */
+/*                                                                        */
+/* In arena mode every top-level form in the REPL or in 'load' allocates  */
+/* from slabs of its own. When the form finishes, slabs whose objects are */
+/* all dead are handed back to the system in one go, and slabs with       */
+/* survivors (definitions, returned values) join the shared free list.    */
+
+#ifndef LPOOL_ARENA
+#define LPOOL_ARENA 1
+#endif
+
+#define LSLAB_SIZE 32768
+#define LSLAB_SLOTS (LSLAB_SIZE / 32)
+
+#ifdef _WIN32
+#define lslab_alloc() _aligned_malloc(LSLAB_SIZE, LSLAB_SIZE)
+#define lslab_free(s) _aligned_free(s)
+#else
+#define lslab_free(s) free(s)
+
+void* lslab_alloc(void) {
+    void* s;
+    return posix_memalign(&s, LSLAB_SIZE, LSLAB_SIZE) == 0 ? s : NULL;
+}
+#endif
+
+typedef struct lslab lslab;
+
+struct lslab {
+    lslab* next;
+    int live;
+    bool arena;
+    unsigned char used[LSLAB_SLOTS / 8];
+    unsigned char marked[LSLAB_SLOTS / 8];
+};
+
+#define LSLAB_HEADER ((sizeof(lslab) + 15) & ~(size_t)15)
+
+/* Slots must be at least 32 bytes for the bitmaps to cover the slab */
+typedef struct {
+    size_t size;
+    int live;
+
+    /* Slabs outliving any single form, and their free slots */
+    lslab* slabs;
+    void* free;
+
+    /* Slabs opened by the current top-level form */
+    lslab* arena;
+    void* arena_free;
+} lpool;
+
+int lpool_depth = 0;
+
+lslab* lslab_of(void* x) {
+    return (lslab*)((uintptr_t)x & ~(uintptr_t)(LSLAB_SIZE - 1));
+}
+
+int lslab_index(lpool* p, void* x) {
+    lslab* s = lslab_of(x);
+    return (int)(((char*)x - ((char*)s + LSLAB_HEADER)) / p->size);
+}
+
+void lpool_grow(lpool* p) {
+    lslab* s = lslab_alloc();
+    if (!s) { fputs("Out of memory.\n", stderr); exit(1); }
+
+    s->live = 0;
+    s->arena = LPOOL_ARENA && lpool_depth > 0;
+    memset(s->used, 0, sizeof(s->used));
+    memset(s->marked, 0, sizeof(s->marked));
+
+    void** list = s->arena ? &p->arena_free : &p->free;
+    if (s->arena) {
+        s->next = p->arena; p->arena = s;
+    } else {
+        s->next = p->slabs; p->slabs = s;
+    }
+
+    /* Thread every slot after the header onto the free list */
+    for (size_t off = LSLAB_HEADER; off + p->size <= LSLAB_SIZE; off += p->size) {
+        void** slot = (void**)((char*)s + off);
+        *slot = *list;
+        *list = slot;
+    }
+}
+
+void* lpool_alloc(lpool* p) {
+    void** list = LPOOL_ARENA && lpool_depth > 0 ? &p->arena_free : &p->free;
+    if (!*list) { lpool_grow(p); }
+
+    void** x = *list;
+    *list = *x;
+
+    lslab* s = lslab_of(x);
+    int i = lslab_index(p, x);
+    s->used[i / 8] |= 1 << (i % 8);
+    s->live++;
+    p->live++;
+    return x;
+}
+
+void lpool_free(lpool* p, void* x) {
+    lslab* s = lslab_of(x);
+    int i = lslab_index(p, x);
+    s->used[i / 8] &= ~(1 << (i % 8));
+    s->live--;
+    p->live--;
+
+    void** list = s->arena ? &p->arena_free : &p->free;
+    *(void**)x = *list;
+    *list = x;
+}
+
+void lpool_release(lpool* p) {
+
+    /* Keep free slots of slabs that still hold live objects */
+    void** x = p->arena_free;
+    while (x) {
+        void** next = *x;
+        if (lslab_of(x)->live) {
+            *x = p->free;
+            p->free = x;
+        }
+        x = next;
+    }
+    p->arena_free = NULL;
+
+    /* Return empty slabs, the rest become ordinary slabs */
+    lslab* s = p->arena;
+    while (s) {
+        lslab* next = s->next;
+        if (s->live == 0) {
+            lslab_free(s);
+        } else {
+            s->arena = false;
+            s->next = p->slabs;
+            p->slabs = s;
+        }
+        s = next;
+    }
+    p->arena = NULL;
+}
+
+/* Symbols */
+
+/* Every symbol name is interned once in a global open-addressing table, */
+/* so symbols and environment keys can be compared by pointer. Interned  */
+/* names live for the rest of the program and are never freed.          */
+/*                                                                       */
+/* Each name is stored behind a header that caches where it is bound in  */
+/* the global environment, and counts the frames that currently bind it. */
+/* While no frame does, a lookup of the name from anywhere can only end  */
+/* at the global binding, and goes straight to it. The hash of the name  */
+/* is kept there too, for the structural hash of values that contain it.  */
+
+typedef struct {
+    lenv* global;
+    int index;
+    int frames;
+    unsigned hash;
+    char name[];
+} lsym;
+
+lsym* lsym_of(char* s) {
+    return (lsym*)(s - offsetof(lsym, name));
+}
+
+char** lsym_table = NULL;
+int lsym_count = 0;
+int lsym_cap = 0;
+
+size_t lsym_hash(char* s) {
+    size_t h = 2166136261u;
+    for (; *s; s++) { h = (h ^ (unsigned char)*s) * 16777619u; }
+    return h;
+}
+
+void lsym_grow(void) {
+    char** old = lsym_table;
+    int old_cap = lsym_cap;
+
+    lsym_cap = lsym_cap ? lsym_cap * 2 : 256;
+    lsym_table = calloc(lsym_cap, sizeof(char*));
+
+    for (int i = 0; i < old_cap; i++) {
+        if (!old[i]) { continue; }
+        size_t h = lsym_hash(old[i]) & (lsym_cap - 1);
+        while (lsym_table[h]) { h = (h + 1) & (lsym_cap - 1); }
+        lsym_table[h] = old[i];
+    }
+    free(old);
+}
+
+char* lsym_intern(char* s) {
+    if ((lsym_count + 1) * 2 > lsym_cap) { lsym_grow(); }
+
+    size_t h = lsym_hash(s) & (lsym_cap - 1);
+    while (lsym_table[h]) {
+        if (strcmp(lsym_table[h], s) == 0) { return lsym_table[h]; }
+        h = (h + 1) & (lsym_cap - 1);
+    }
+
+    lsym* x = malloc(sizeof(lsym) + strlen(s) + 1);
+    x->global = NULL;
+    x->index = -1;
+    x->frames = 0;
+    x->hash = (unsigned)lsym_hash(s);
+    strcpy(x->name, s);
+
+    lsym_table[h] = x->name;
+    lsym_count++;
+    return lsym_table[h];
+}
+
+/* The '&' that marks a variadic formal, interned at startup */
+char* lsym_amp;
 
 /* Lisp Value */
 
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_STR, LVAL_STRUCT, LVAL_INST };
+enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_STR, LVAL_STRUCT, LVAL_INST, LVAL_DBL, LVAL_BIG, LVAL_ARRAY };
+
+typedef lval*(*lbuiltin)(lenv*, lval**, int);
 
-typedef lval*(*lbuiltin)(lenv*, lval*);
+/* Strings of up to this many bytes are kept inside their value, which  */
+/* has room for 15 without growing. See lval_strcap.                    */
+#ifndef LVAL_SMALL_STR
+#define LVAL_SMALL_STR 15
+#endif
+
+/* Only the payload for the value's own type is stored. The fields read */
+/* on every traversal of an expression come first so that a list walk   */
+/* touches just the head of each node.                                  */
 
 struct lval {
     int type;
+    int rc;
 
-    long num;
-    char* err;
-    char* sym;
-    char* str;
+    /* Expressions, and the arguments a partial application has bound. */
+    /* cap is the number of cells allocated, count the number in use.   */
+    int count;
+    int cap;
+    lval** cell;
 
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
+    union {
+        long num;
+        double dbl;
+        char* err;
+
+        /* Arrays: count integers or doubles, as kind is LVAL_NUM or LVAL_DBL */
+        struct {
+            union {
+                int64_t* ints;
+                double* dbls;
+            };
+            int kind;
+        };
+
+        /* Integers too big for a long: ndigits digits in base 1e9, least */
+        /* significant first, with the sign as 1 or -1. See lbig_load.    */
+        struct {
+            uint32_t* digits;
+            int ndigits;
+            int sign;
+        };
+
+        /* Strings and lists, with their structural hash or 0 if it has */
+        /* not been needed yet. See lval_hash.                          */
+        struct {
+            union {
+                char* str;
+
+                /* Lists whose cells are a view into shared storage, else NULL */
+                lbuf* buf;
+            };
+            unsigned hash;
+
+            /* Strings: the storage str points into, else up to */
+            /* LVAL_SMALL_STR bytes held in place, at small.     */
+            union {
+                lstrbuf* sbuf;
+                char small[LVAL_SMALL_STR + 1];
+            };
+        };
+
+        /* Symbols, with the frame slot they were resolved to or -1 */
+        struct {
+            char* sym;
+            int slot;
+        };
+
+        /* Functions */
+        struct {
+            lbuiltin builtin;
+            lval* formals;
+            lval* body;
+            lcode* code;
+        };
+
+        /* Structs */
+        struct {
+            char* struc;
+            lval* fields;
+        };
+    };
+};
 
-    /* Structs */
-    char* struc;
-    lval* fields;
+/* Compiled lambda body, shared by every copy of the lambda */
 
+struct lcode {
+    int rc;
     int count;
-    lval** cell;
+    int* ops;
+    int nconsts;
+    lval** consts;
+    int depth;
+    int max_stack;
+
+    /* Formal names, and whether each takes exactly one argument */
+    int nformals;
+    char** syms;
+    bool simple;
+};
+
+/* Storage shared by list views. Slots [lo, hi) hold a reference each */
+/* and are never overwritten; the free slots either side are claimed  */
+/* by whichever view first grows into them.                           */
+
+struct lbuf {
+    int rc;
+    int lo;
+    int hi;
+    int size;
+    lval** slots;
+    unsigned mark;
 };
 
+/* Lambdas are compiled to bytecode unless this is 0 */
+#ifndef LVAL_VM
+#define LVAL_VM 1
+#endif
+
+/* Integers that fit in a pointer with one bit to spare are stored inline */
+/* as tagged pointers with the low bit set. These fixnums never touch the */
+/* heap: they are not allocated, reference counted or freed. Only numbers */
+/* outside that range are boxed in a struct lval.                         */
+
+#define LVAL_FIXNUM_MIN (INTPTR_MIN >> 1)
+#define LVAL_FIXNUM_MAX (INTPTR_MAX >> 1)
+
+int lval_is_fixnum(lval* v) {
+    return ((uintptr_t)v & 1) != 0;
+}
+
+/* Doubles are stored inline too, as flonums tagged with the low bits 10, */
+/* when the pointer is wide enough and the exponent is in the middle of   */
+/* its range: from about 1e-77 to 1e77 in magnitude, and +0.0. The bits   */
+/* are rotated so the sign and mantissa survive intact, and the top two   */
+/* exponent bits, which that range fixes, make room for the tag. Other    */
+/* doubles are boxed, like integers outside the fixnum range.             */
+
+#define LVAL_FLONUM (UINTPTR_MAX > 0xffffffffu)
+#define LVAL_FLONUM_ZERO ((uint64_t)1 << 63 | 2)
+
+int lval_is_flonum(lval* v) {
+    return ((uintptr_t)v & 3) == 2;
+}
+
+/* Values that are not pointers at all */
+int lval_is_immediate(lval* v) {
+    return ((uintptr_t)v & 3) != 0;
+}
+
+int lval_type(lval* v) {
+    if (lval_is_fixnum(v)) { return LVAL_NUM; }
+    if (lval_is_flonum(v)) { return LVAL_DBL; }
+    return v->type;
+}
+
+long lval_number(lval* v) {
+    return lval_is_fixnum(v) ? (long)((intptr_t)v >> 1) : v->num;
+}
+
+/* The value of a float, or of an integer promoted to one */
+double lval_double(lval* v) {
+    if (lval_is_fixnum(v)) { return (double)lval_number(v); }
+    if (lval_is_flonum(v)) {
+        uint64_t u = (uintptr_t)v;
+        if (u == LVAL_FLONUM_ZERO) { return 0.0; }
+        u = (u & ~(uint64_t)3) | (2 - (u >> 63));
+        u = u >> 3 | u << 61;
+
+        double d;
+        memcpy(&d, &u, sizeof(d));
+        return d;
+    }
+    if (v->type == LVAL_BIG) {
+        double d = 0;
+        for (int i = v->ndigits - 1; i >= 0; i--) { d = d * 1e9 + v->digits[i]; }
+        return v->sign * d;
+    }
+    return v->type == LVAL_DBL ? v->dbl : (double)v->num;
+}
+
+lpool lval_pool = { sizeof(lval), 0, NULL, NULL, NULL, NULL };
+
+lval* lval_new(int type) {
+    lval* v = lpool_alloc(&lval_pool);
+    v->type = type;
+    v->rc = 1;
+    return v;
+}
+
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+        return (lval*)(((uintptr_t)(intptr_t)x << 1) | 1);
+    }
+
+    lval* v = lval_new(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+lval* lval_dbl(double x) {
+    if (LVAL_FLONUM) {
+        uint64_t u;
+        memcpy(&u, &x, sizeof(u));
+
+        int bits = (int)(u >> 60 & 7);
+        if (u != (uint64_t)3 << 60 && ((bits - 3) & ~1) == 0) {
+            return (lval*)(uintptr_t)(((u << 3 | u >> 61) & ~(uint64_t)1) | 2);
+        }
+        if (u == 0) { return (lval*)(uintptr_t)LVAL_FLONUM_ZERO; }
+    }
+
+    lval* v = lval_new(LVAL_DBL);
+    v->dbl = x;
+    return v;
+}
+
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_new(LVAL_ERR);
     
     /* Create a va list and initialize it */
     va_list va;
@@ -95,82 +523,208 @@ lval* lval_err(char* fmt, ...) {
 }
 
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    lval* v = lval_new(LVAL_SYM);
+    v->sym = lsym_intern(s);
+    v->slot = -1;
+    return v;
+}
+
+/* Strings                                                                  */
+/*                                                                          */
+/* A string is count bytes from str, kept with their length so nothing has  */
+/* to scan for a terminator. Strings of up to LVAL_SMALL_STR bytes are held */
+/* in the value itself, so most symbols-as-text, keys and words cost no     */
+/* allocation beyond their lval. Longer ones point into storage that other  */
+/* strings can share: 'substr' and 'split' return views of their argument's */
+/* bytes, and 'str-concat' writes onto the end of its first argument, in    */
+/* place, when that is the last string in its storage and there is room.   */
+/* Building a string by repeated concatenation then takes amortised time in */
+/* proportion to what is added, as 'cons' and 'join' do for lists. The      */
+/* bytes a string covers never change, but those after it may belong to     */
+/* another string, so code reads count bytes rather than to a terminator.   */
+
+struct lstrbuf {
+    int rc;
+    int hi;
+    int size;
+    char bytes[];
+};
+
+void lstrbuf_del(lstrbuf* b) {
+    if (--b->rc == 0) { free(b); }
+}
+
+int lval_str_small(lval* v) {
+    return v->str == v->small;
+}
+
+/* Terminates v and marks its storage as used up to the end of v */
+void lval_str_claim(lval* v) {
+    v->str[v->count] = '\0';
+    if (!lval_str_small(v)) { v->sbuf->hi = v->str + v->count - v->sbuf->bytes; }
+}
+
+/* A new string of the n bytes at s, with room to grow to cap */
+lval* lval_strcap(char* s, int n, int cap) {
+    lval* v = lval_new(LVAL_STR);
+    if (cap <= LVAL_SMALL_STR) {
+        v->str = v->small;
+    } else {
+        lstrbuf* b = malloc(sizeof(lstrbuf) + cap + 1);
+        b->rc = 1;
+        b->size = cap;
+        v->sbuf = b;
+        v->str = b->bytes;
+    }
+    memcpy(v->str, s, n);
+    v->count = n;
+    v->hash = 0;
+    lval_str_claim(v);
     return v;
 }
 
+lval* lval_strn(char* s, int n) {
+    return lval_strcap(s, n, n);
+}
+
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
+    return lval_strn(s, strlen(s));
+}
+
+/* The n bytes of x from start. Short ones are copied, so that a small */
+/* piece does not keep a large string's storage alive.                 */
+lval* lval_substr(lval* x, int start, int n) {
+    if (n <= LVAL_SMALL_STR) { return lval_strn(x->str + start, n); }
+
+    lval* v = lval_new(LVAL_STR);
+    v->sbuf = x->sbuf;
+    v->sbuf->rc++;
+    v->str = x->str + start;
+    v->count = n;
+    v->hash = 0;
+    return v;
+}
+
+/* A new string of the bytes of x followed by those of the n strings in xs */
+lval* lval_str_append(lval* x, lval** xs, int n) {
+    int add = 0;
+    for (int i = 0; i < n; i++) { add += xs[i]->count; }
+    int count = x->count + add;
+
+    lval* v;
+    lstrbuf* b = x->sbuf;
+    if (!lval_str_small(x) && x->str + x->count == b->bytes + b->hi
+        && b->hi + add <= b->size) {
+        v = lval_new(LVAL_STR);
+        v->sbuf = b;
+        v->str = x->str;
+        v->hash = 0;
+        b->rc++;
+    } else {
+        /* Copy into storage with as much room again behind */
+        v = lval_strcap(x->str, x->count, count <= LVAL_SMALL_STR ? count : count * 2);
+    }
+
+    char* p = v->str + x->count;
+    for (int i = 0; i < n; i++) {
+        memcpy(p, xs[i]->str, xs[i]->count);
+        p += xs[i]->count;
+    }
+    v->count = count;
+    lval_str_claim(v);
     return v;
 }
 
+/* The bytes of a string in a new NUL-terminated block, for C interfaces */
+char* lval_cstr(lval* v) {
+    char* s = malloc(v->count + 1);
+    memcpy(s, v->str, v->count);
+    s[v->count] = '\0';
+    return s;
+}
+
 lval* lval_builtin(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
     v->builtin = func;
     return v;
 }
 
 lenv* lenv_new(void);
 
+/* Scope is dynamic, so a lambda's free symbols are looked up from its */
+/* caller and nothing is captured when it is created. The only values  */
+/* a lambda holds are arguments from a partial application, kept in    */
+/* its cells for the leading formals.                                  */
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
     v->builtin = NULL;
-    v->env = lenv_new();
+    v->count = 0;
+    v->cap = 0;
+    v->cell = NULL;
     v->formals = formals;
     v->body = body;
+    v->code = NULL;
     return v;
 }
 
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->buf = NULL;
+    v->hash = 0;
     return v;
 }
 
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->buf = NULL;
+    v->hash = 0;
     return v;
 }
 
 lval* lval_struct(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STRUCT;
+    lval* v = lval_new(LVAL_STRUCT);
     v->fields = NULL;
     return v;
 }
 
 lval* lval_instance(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_INST;
+    lval* v = lval_new(LVAL_INST);
     v->struc = NULL;
     v->fields = NULL;
     return v;
 }
 
 void lenv_del(lenv* e);
+void lcode_del(lcode* c);
+void lbuf_del(lbuf* b);
+void lval_hcons_forget(lval* v);
 
 void lval_del(lval* v) {
 
+    /* Values are shared, only free once the last reference is dropped */
+    if (lval_is_immediate(v) || --v->rc > 0) { return; }
+
     switch (v->type) {
         case LVAL_NUM: break;
+        case LVAL_DBL: break;
+        case LVAL_BIG: free(v->digits); break;
+        case LVAL_ARRAY: free(v->ints); break;
         case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        case LVAL_SYM: break;
+        case LVAL_STR:
+            lval_hcons_forget(v);
+            if (!lval_str_small(v)) { lstrbuf_del(v->sbuf); }
+            break;
         case LVAL_QEXPR:
         case LVAL_SEXPR:
+            lval_hcons_forget(v);
+            if (v->buf) { lbuf_del(v->buf); break; }
             for (int i = 0; i < v->count; i++) {
                 lval_del(v->cell[i]);
             }
@@ -178,100 +732,67 @@ void lval_del(lval* v) {
         break;
         case LVAL_FUN:
             if (!v->builtin) {
-                lenv_del(v->env);
+                for (int i = 0; i < v->count; i++) {
+                    lval_del(v->cell[i]);
+                }
+                free(v->cell);
                 lval_del(v->body);
                 lval_del(v->formals);
+                if (v->code) { lcode_del(v->code); }
             }
             break;
         case LVAL_STRUCT:
             lval_del(v->fields);
             break; 
         case LVAL_INST:
-            free(v->struc);
             lval_del(v->fields);
     }
     
-    free(v);
+    lpool_free(&lval_pool, v);
 }
 
-lenv* lenv_copy(lenv* env);
 
 lval* lval_copy(lval* v) {
+    /* Copies share structure, they only take another reference */
+    if (lval_is_immediate(v)) { return v; }
+    v->rc++;
+    return v;
+}
 
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
-    
-    switch (v->type) {
-        
-        /* Copy Functions and Numbers Directly */
-        case LVAL_NUM: x->num = v->num; break;
-        
-        /* Copy Strings using malloc and strcpy */
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
-            
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
-        
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
-
-        /* Copy Lists by copying each sub-expression */
-        case LVAL_SEXPR:
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-            break;
-        case LVAL_FUN:
-            if (v->builtin) {
-                x->builtin = v->builtin;
-            } else {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_STRUCT:
-             x->fields = lval_copy(v->fields);
-             break;
-        case LVAL_INST:
-            x->struc = malloc(strlen(v->struc) + 1);
-            strcpy(x->struc, v->struc);
-            x->fields = lval_copy(v->fields);
-    }
-    
-    return x;
+/* Makes room for at least n cells. Capacity at least doubles each time */
+/* it grows, so appending is amortised constant time, and a fresh list  */
+/* reserved to its final size is allocated exactly.                     */
+void lval_own(lval* v);
+
+void lval_reserve(lval* v, int n) {
+    if (v->buf) { lval_own(v); }
+    if (n <= v->cap) { return; }
+    int cap = v->cap * 2;
+    if (cap < n) { cap = n; }
+    v->cell = realloc(v->cell, sizeof(lval*) * cap);
+    v->cap = cap;
 }
 
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    lval_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
+    v->hash = 0;
     return v;
 }
 
-lval* lval_join(lval* x, lval* y) {    
-    for (int i = 0; i < y->count; i++) {
-        x = lval_add(x, y->cell[i]);
-    }
-    free(y->cell);
-    free(y);    
-    return x;
-}
-
 lval* lval_pop(lval* v, int i) {
+    if (v->buf) { lval_own(v); }
     lval* x = v->cell[i];    
     memmove(&v->cell[i], &v->cell[i+1],
         sizeof(lval*) * (v->count-i-1));    
     v->count--;    
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    v->hash = 0;
+
+    /* Give memory back only once the list is well under capacity */
+    if (v->cap > 16 && v->count * 4 < v->cap) {
+        v->cap /= 2;
+        v->cell = realloc(v->cell, sizeof(lval*) * v->cap);
+    }
     return x;
 }
 
@@ -281,23 +802,303 @@ lval* lval_take(lval* v, int i) {
     return x;
 }
 
+/* List views                                                             */
+/*                                                                        */
+/* A Q-expression either owns its cell array or is a view of count cells  */
+/* inside an lbuf. Views make 'rest' a pointer bump, and let 'cons' and   */
+/* 'join' extend a list in place when it starts (or ends) exactly at the  */
+/* claimed edge of its storage: every list built by consing onto, or      */
+/* joining onto, the newest version of another takes amortised constant  */
+/* time per element added. An older version that finds its edge already  */
+/* claimed copies into new storage instead, so every list is persistent.  */
+/* Code that changes a list in place first turns a view back into an     */
+/* array of its own.                                                      */
+
+lbuf* lbuf_new(int size) {
+    lbuf* b = malloc(sizeof(lbuf));
+    b->rc = 0;
+    b->lo = b->hi = 0;
+    b->size = size;
+    b->slots = malloc(sizeof(lval*) * size);
+    b->mark = 0;
+    return b;
+}
+
+void lbuf_del(lbuf* b) {
+    if (--b->rc > 0) { return; }
+    for (int i = b->lo; i < b->hi; i++) { lval_del(b->slots[i]); }
+    free(b->slots);
+    free(b);
+}
+
+lval* lval_view(lbuf* b, lval** cell, int count) {
+    lval* v = lval_qexpr();
+    v->buf = b;
+    v->cell = cell;
+    v->count = v->cap = count;
+    b->rc++;
+    return v;
+}
+
+/* Hands the cells a list owns over to new storage, in place. The list */
+/* reads the same afterwards, so this is safe even while it is shared. */
+void lval_share(lval* v) {
+    lbuf* b = malloc(sizeof(lbuf));
+    b->rc = 1;
+    b->lo = 0;
+    b->hi = v->count;
+    b->size = v->cap;
+    b->slots = v->cell;
+    b->mark = 0;
+    v->buf = b;
+}
+
+void lval_own(lval* v) {
+    lval** cell = malloc(sizeof(lval*) * v->count);
+    for (int i = 0; i < v->count; i++) { cell[i] = lval_copy(v->cell[i]); }
+    lbuf_del(v->buf);
+    v->buf = NULL;
+    v->cell = cell;
+    v->cap = v->count;
+}
+
+/* A new list of x followed by the elements of l */
+lval* lval_cons(lval* x, lval* l) {
+    if (l->count == 0) { return lval_add(lval_qexpr(), lval_copy(x)); }
+    if (!l->buf) { lval_share(l); }
+
+    lbuf* b = l->buf;
+    if (l->cell == b->slots + b->lo && b->lo > 0) {
+        b->slots[--b->lo] = lval_copy(x);
+        return lval_view(b, l->cell - 1, l->count + 1);
+    }
+
+    /* Copy into storage with as much free room in front */
+    int n = l->count + 1;
+    b = lbuf_new(n * 2);
+    b->lo = b->hi = b->size;
+    for (int i = l->count - 1; i >= 0; i--) { b->slots[--b->lo] = lval_copy(l->cell[i]); }
+    b->slots[--b->lo] = lval_copy(x);
+    return lval_view(b, b->slots + b->lo, n);
+}
+
+/* A new list of the elements of l followed by the n values in xs */
+lval* lval_append(lval* l, lval** xs, int n) {
+    if (n == 0) { return lval_copy(l); }
+    if (l->count == 0) {
+        lval* v = lval_qexpr();
+        lval_reserve(v, n);
+        for (int i = 0; i < n; i++) { v->cell[v->count++] = lval_copy(xs[i]); }
+        return v;
+    }
+    if (!l->buf) { lval_share(l); }
+
+    lbuf* b = l->buf;
+    if (l->cell + l->count == b->slots + b->hi && b->hi + n <= b->size) {
+        for (int i = 0; i < n; i++) { b->slots[b->hi++] = lval_copy(xs[i]); }
+        return lval_view(b, l->cell, l->count + n);
+    }
+
+    /* Copy into storage with as much free room behind */
+    int count = l->count + n;
+    b = lbuf_new(count * 2);
+    for (int i = 0; i < l->count; i++) { b->slots[b->hi++] = lval_copy(l->cell[i]); }
+    for (int i = 0; i < n; i++) { b->slots[b->hi++] = lval_copy(xs[i]); }
+    return lval_view(b, b->slots, count);
+}
+
+/* A new list of the count elements of l from start on, sharing storage */
+lval* lval_slice(lval* l, int start, int count) {
+    if (count == 0) { return lval_qexpr(); }
+    if (!l->buf) { lval_share(l); }
+    return lval_view(l->buf, l->cell + start, count);
+}
+
+/* Structural hashes                                                     */
+/*                                                                       */
+/* Values that lval_eq finds equal hash equally. Strings and lists cache */
+/* their hash the first time it is asked for: a list is only changed in  */
+/* place while it is being built, and lval_add and lval_pop drop what    */
+/* was cached. Comparing two lists then costs a walk only when their     */
+/* hashes match, and the hashes of the lists inside are cached as well.  */
+
+unsigned lhash_mix(unsigned h, unsigned long x) {
+    h = (h ^ (unsigned)x) * 16777619u;
+    return (h ^ (unsigned)(x >> 32)) * 16777619u;
+}
+
+unsigned lhash_bytes(char* s, int n) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; i++) { h = (h ^ (unsigned char)s[i]) * 16777619u; }
+    return h;
+}
+
+unsigned lval_hash(lval* v) {
+    unsigned h = 2166136261u;
+
+    switch (lval_type(v)) {
+        case LVAL_NUM: return lhash_mix(h, lval_number(v));
+        case LVAL_DBL: {
+            /* -0.0 equals 0.0, so both hash as 0.0 does */
+            double d = lval_double(v) + 0.0;
+            uint64_t u;
+            memcpy(&u, &d, sizeof(u));
+            return lhash_mix(h ^ LVAL_DBL, u);
+        }
+        case LVAL_ARRAY:
+            /* Arrays change in place, so only their shape is hashed */
+            return lhash_mix(lhash_mix(h ^ LVAL_ARRAY, v->kind), v->count);
+        case LVAL_BIG:
+            h = lhash_mix(h, v->sign);
+            for (int i = 0; i < v->ndigits; i++) { h = lhash_mix(h, v->digits[i]); }
+            return h;
+        case LVAL_SYM: return lsym_of(v->sym)->hash;
+        case LVAL_ERR: return (unsigned)lsym_hash(v->err);
+        case LVAL_STR:
+            if (!v->hash) { v->hash = lhash_bytes(v->str, v->count) | 1; }
+            return v->hash;
+        case LVAL_FUN:
+            if (v->builtin) { return lhash_mix(h, (uintptr_t)v->builtin); }
+            for (int i = v->count; i < v->formals->count; i++) {
+                h = lhash_mix(h, lval_hash(v->formals->cell[i]));
+            }
+            return lhash_mix(h, lval_hash(v->body));
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            if (v->hash) { return v->hash; }
+            h = lhash_mix(h, v->type);
+            for (int i = 0; i < v->count; i++) {
+                h = lhash_mix(h, lval_hash(v->cell[i]));
+            }
+            v->hash = h | 1;
+            return v->hash;
+    }
+
+    return lhash_mix(h, v->type);
+}
+
+/* Hash-consing                                                         */
+/*                                                                      */
+/* With LVAL_HASHCONS set, every string and Q-expression the reader     */
+/* builds is looked up in a table of those already live, and an equal   */
+/* one is shared instead: repeated literal data takes memory once, and  */
+/* is then equal to its repeats by pointer. The table does not hold a   */
+/* reference, so an entry goes when the last reference to it does, or  */
+/* when a collection finds it unreachable.                              */
+
+#ifndef LVAL_HASHCONS
+#define LVAL_HASHCONS 0
+#endif
+
+lval** lhcons_table = NULL;
+int lhcons_count = 0;
+int lhcons_cap = 0;
+
+/* Marks a slot whose entry has gone, so probing carries on past it */
+lval lhcons_gone;
+
+/* Gone slots count towards the load until the table is rebuilt here, */
+/* which only grows it if the live entries alone would fill it.       */
+void lhcons_grow(void) {
+    lval** old = lhcons_table;
+    int old_cap = lhcons_cap;
+
+    int live = 0;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i] && old[i] != &lhcons_gone) { live++; }
+    }
+
+    if (!lhcons_cap) { lhcons_cap = 256; }
+    if ((live + 1) * 4 > lhcons_cap) { lhcons_cap *= 2; }
+    lhcons_table = calloc(lhcons_cap, sizeof(lval*));
+    lhcons_count = 0;
+
+    for (int i = 0; i < old_cap; i++) {
+        if (!old[i] || old[i] == &lhcons_gone) { continue; }
+        unsigned h = old[i]->hash & (lhcons_cap - 1);
+        while (lhcons_table[h]) { h = (h + 1) & (lhcons_cap - 1); }
+        lhcons_table[h] = old[i];
+        lhcons_count++;
+    }
+    free(old);
+}
+
+int lval_eq(lval* x, lval* y);
+
+/* Consumes v, returning it or an equal value already in the table */
+lval* lval_hcons(lval* v) {
+    if (!LVAL_HASHCONS) { return v; }
+    if ((lhcons_count + 1) * 2 > lhcons_cap) { lhcons_grow(); }
+
+    unsigned h = lval_hash(v) & (lhcons_cap - 1);
+    while (lhcons_table[h]) {
+        lval* x = lhcons_table[h];
+        if (x != &lhcons_gone && x->type == v->type && x->hash == v->hash && lval_eq(x, v)) {
+            lval_del(v);
+            return lval_copy(x);
+        }
+        h = (h + 1) & (lhcons_cap - 1);
+    }
+
+    lhcons_table[h] = v;
+    lhcons_count++;
+    return v;
+}
+
+/* Called as a string or list is freed. Only its cached hash is read, */
+/* as what it points to may already be gone.                          */
+void lval_hcons_forget(lval* v) {
+    if (!LVAL_HASHCONS || !v->hash || !lhcons_table) { return; }
+
+    unsigned h = v->hash & (lhcons_cap - 1);
+    while (lhcons_table[h]) {
+        if (lhcons_table[h] == v) { lhcons_table[h] = &lhcons_gone; return; }
+        h = (h + 1) & (lhcons_cap - 1);
+    }
+}
+
+int lbig_cmp_mag(uint32_t* a, int na, uint32_t* b, int nb);
+
 int lval_eq(lval* x, lval* y) {
-    if (x->type != y->type) { return 0; }
+    if (lval_type(x) != lval_type(y)) { return 0; }
 
-    switch (x->type) {
-        case LVAL_NUM: return x->num == y->num;
-        case LVAL_SYM: return strcmp(x->sym, y->sym) == 0;
+    switch (lval_type(x)) {
+        case LVAL_NUM: return lval_number(x) == lval_number(y);
+        case LVAL_DBL: return lval_double(x) == lval_double(y);
+        case LVAL_ARRAY:
+            if (x->kind != y->kind || x->count != y->count) { return 0; }
+            for (int i = 0; i < x->count; i++) {
+                if (x->kind == LVAL_DBL ? x->dbls[i] != y->dbls[i] : x->ints[i] != y->ints[i]) { return 0; }
+            }
+            return 1;
+        case LVAL_BIG:
+            return x->sign == y->sign
+                && lbig_cmp_mag(x->digits, x->ndigits, y->digits, y->ndigits) == 0;
+        case LVAL_SYM: return x->sym == y->sym;
         case LVAL_ERR: return strcmp(x->sym, y->sym) == 0;
-        case LVAL_STR: return strcmp(x->str, y->str) == 0;
+        case LVAL_STR:
+            if (x == y) { return 1; }
+            if (lval_hash(x) != lval_hash(y)) { return 0; }
+            return x->count == y->count && memcmp(x->str, y->str, x->count) == 0;
         case LVAL_FUN:
             if (x->builtin || y->builtin) {
                 return x->builtin == y->builtin;
             } else {
-                return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+                /* Compare what is left to apply, not what has been bound */
+                int n = x->formals->count - x->count;
+                if (n != y->formals->count - y->count) { return 0; }
+                for (int i = 0; i < n; i++) {
+                    if (!lval_eq(x->formals->cell[x->count + i], y->formals->cell[y->count + i])) {
+                        return 0;
+                    }
+                }
+                return lval_eq(x->body, y->body);
             }
         case LVAL_QEXPR:
         case LVAL_SEXPR:
+            if (x == y) { return 1; }
             if (x->count != y->count) { return 0; }
+            if (lval_hash(x) != lval_hash(y)) { return 0; }
             for (int i=0; i < x->count; i++) {
                 if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
             }
@@ -323,16 +1124,42 @@ void lval_print_expr(lval* v, char open, char close) {
 }
 
 void lval_print_str(lval* v) {
-    char* escaped = malloc(strlen(v->str) + 1);
-    strcpy(escaped, v->str);
-    escaped = mpcf_escape(escaped);
+    char* escaped = mpcf_escape(lval_cstr(v));
     printf("\"%s\"", escaped);
     free(escaped);
 }
 
+/* Prints the shortest of 15 or 17 digits that reads back as x, and */
+/* always with a point or exponent so it reads back as a float.     */
+void lval_print_dbl(double x) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", x);
+    if (strtod(buf, NULL) != x) { snprintf(buf, sizeof(buf), "%.17g", x); }
+    if (!strpbrk(buf, ".einf")) { strcat(buf, ".0"); }
+    printf("%s", buf);
+}
+
+void lval_print_big(lval* v) {
+    printf("%s%u", v->sign < 0 ? "-" : "", v->digits[v->ndigits - 1]);
+    for (int i = v->ndigits - 2; i >= 0; i--) { printf("%09u", v->digits[i]); }
+}
+
+void lval_print_array(lval* v) {
+    putchar('[');
+    for (int i = 0; i < v->count; i++) {
+        if (i) { putchar(' '); }
+        if (v->kind == LVAL_DBL) { lval_print_dbl(v->dbls[i]); }
+        else { printf("%li", (long)v->ints[i]); }
+    }
+    putchar(']');
+}
+
 void lval_print(lval* v) {
-    switch (v->type) {
-        case LVAL_NUM:     printf("%li", v->num); break;
+    switch (lval_type(v)) {
+        case LVAL_NUM:     printf("%li", lval_number(v)); break;
+        case LVAL_DBL:     lval_print_dbl(lval_double(v)); break;
+        case LVAL_BIG:     lval_print_big(v); break;
+        case LVAL_ARRAY:   lval_print_array(v); break;
         case LVAL_ERR:     printf("Error: %s", v->err); break;
         case LVAL_SYM:     printf("%s", v->sym); break;
         case LVAL_STR:     lval_print_str(v); break;
@@ -342,9 +1169,12 @@ void lval_print(lval* v) {
             if (v->builtin) {
                 printf("<builtin>");
             } else {
-                printf("(lambda ");
-                lval_print(v->formals);
-                putchar(' ');
+                printf("(lambda {");
+                for (int i = v->count; i < v->formals->count; i++) {
+                    lval_print(v->formals->cell[i]);
+                    if (i != v->formals->count - 1) { putchar(' '); }
+                }
+                printf("} ");
                 lval_print(v->body);
                 putchar(')');
             }
@@ -364,6 +1194,9 @@ char* ltype_name(int t) {
     switch(t) {
         case LVAL_FUN: return "Function";
         case LVAL_NUM: return "Number";
+        case LVAL_DBL: return "Float";
+        case LVAL_BIG: return "Bignum";
+        case LVAL_ARRAY: return "Array";
         case LVAL_ERR: return "Error";
         case LVAL_STR: return "String";
         case LVAL_SYM: return "Symbol";
@@ -377,85 +1210,185 @@ char* ltype_name(int t) {
 
 /* Lisp Environment */
 
+/* Symbols are interned, so keys are compared by pointer. Small frames  */
+/* are scanned linearly; once an environment grows past LENV_HASH_MIN   */
+/* entries it also keeps an open-addressing index from symbol to entry. */
+
+#define LENV_HASH_MIN 8
+
 struct lenv {
     lenv* parent;
     int count;
     char** syms;
     lval** vals;
+
+    /* Entry index + 1 for each bucket, 0 when empty */
+    int buckets;
+    int* index;
 };
 
+lpool lenv_pool = { sizeof(lenv), 0, NULL, NULL, NULL, NULL };
+
 lenv* lenv_new(void) {
 
     /* Initialize struct */
-    lenv* e = malloc(sizeof(lenv));
+    lenv* e = lpool_alloc(&lenv_pool);
     e->parent = NULL;
     e->count = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->buckets = 0;
+    e->index = NULL;
     return e;   
 }
 
-void lenv_del(lenv* e) {
-    
-    /* Iterate over all items in environment deleting them */
+/* Keep the symbol headers up to date: frames are counted against each */
+/* name they bind, and the global environment, the one with no parent,  */
+/* records where it binds each name.                                   */
+void lenv_link(lenv* e, char* sym, int i) {
+    lsym* s = lsym_of(sym);
+    if (e->parent) {
+        s->frames++;
+    } else {
+        s->global = e;
+        s->index = i;
+    }
+}
+
+void lenv_unlink(lenv* e) {
+    for (int i = 0; i < e->count; i++) {
+        lsym* s = lsym_of(e->syms[i]);
+        if (e->parent) {
+            s->frames--;
+        } else if (s->global == e) {
+            s->global = NULL;
+        }
+    }
+}
+
+void lenv_del(lenv* e) {
+    lenv_unlink(e);
+    
+    /* Iterate over all items in environment deleting them */
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
         lval_del(e->vals[i]);
     }
     
     /* Free allocated memory for lists */
     free(e->syms);
     free(e->vals);
-    free(e);
+    free(e->index);
+    lpool_free(&lenv_pool, e);
 }
 
-lenv* lenv_copy(lenv* env) {
-    lenv *new = malloc(sizeof(lenv));
-    new->parent = env->parent;
-    new->count = env->count;
-    new->syms = malloc(sizeof(char*) * new->count);
-    new->vals = malloc(sizeof(lval*) * new->count);
+size_t lenv_hash(char* sym) {
+    return ((uintptr_t)sym >> 3) * 2654435761u;
+}
 
-    for (int i=0; i < new->count; i++) {
-        new->syms[i] = malloc(strlen(env->syms[i]) + 1);
-        strcpy(new->syms[i], env->syms[i]);
-        new->vals[i] = lval_copy(env->vals[i]);
+/* Returns the entry index of sym in e alone, or -1 */
+int lenv_find(lenv* e, char* sym) {
+    if (e->index) {
+        size_t mask = e->buckets - 1;
+        for (size_t h = lenv_hash(sym) & mask; e->index[h]; h = (h + 1) & mask) {
+            if (e->syms[e->index[h] - 1] == sym) { return e->index[h] - 1; }
+        }
+        return -1;
     }
 
-    return new;
+    for (int i = 0; i < e->count; i++) {
+        if (e->syms[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+void lenv_index(lenv* e, int i) {
+    size_t mask = e->buckets - 1;
+    size_t h = lenv_hash(e->syms[i]) & mask;
+    while (e->index[h]) { h = (h + 1) & mask; }
+    e->index[h] = i + 1;
+}
+
+void lenv_reindex(lenv* e) {
+    e->buckets = e->buckets ? e->buckets * 2 : LENV_HASH_MIN * 4;
+    free(e->index);
+    e->index = calloc(e->buckets, sizeof(int));
+    for (int i = 0; i < e->count; i++) { lenv_index(e, i); }
 }
 
 lval* lenv_get(lenv* e, lval* k) {
+
+    /* Bound by no frame, so global or nowhere */
+    lsym* s = lsym_of(k->sym);
+    if (s->frames == 0) {
+        if (s->global) { return lval_copy(s->global->vals[s->index]); }
+        return lval_err("Unbound Symbol '%s'", k->sym);
+    }
     
-    /* Iterate over all items in environment */
-    for (int i = 0; i < e->count; i++) {
-        /* Check if the stored string matches the symbol string */
-        /* If it does, return a copy of the value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
+    /* Walk up the environments looking for the symbol */
+    for (; e; e = e->parent) {
+        /* If it is bound here, return a shared reference to the value */
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) {
             return lval_copy(e->vals[i]);
         }
     }
 
-    if (e->parent) {
-        return lenv_get(e->parent, k);
-    } else {
-        return lval_err("Unbound Symbol '%s'", k->sym);
+    return lval_err("Unbound Symbol '%s'", k->sym);
+}
+
+/* True when every name bound in outer is also bound in e, so lookups */
+/* starting at e never stop at outer.                                  */
+bool lenv_shadows(lenv* e, lenv* outer) {
+    for (int i = 0; i < outer->count; i++) {
+        if (lenv_find(e, outer->syms[i]) < 0) { return false; }
+    }
+    return true;
+}
+
+/* True when every name bound in e is bound again by one of the frames */
+/* from top up to, but not including, e. e must be an ancestor of top. */
+bool lenv_hidden(lenv* e, lenv* top) {
+    for (int i = 0; i < e->count; i++) {
+        lenv* f = top;
+        while (f != e && lenv_find(f, e->syms[i]) < 0) { f = f->parent; }
+        if (f == e) { return false; }
+    }
+    return true;
+}
+
+/* A tail call loop holds the frames of calls it has left, the n in held */
+/* oldest first, each the parent of the next and the newest the parent   */
+/* of top. This drops those whose names newer frames all bind again, as  */
+/* lookups can then never reach them, so a loop holds at most one frame  */
+/* per name however long it runs. Returns how many frames are left.     */
+int lenv_prune(lenv* top, lenv** held, int n) {
+    lenv* child = top;
+    for (int i = n - 1; i >= 0; i--) {
+        if (lenv_hidden(held[i], top)) {
+            child->parent = held[i]->parent;
+            lenv_del(held[i]);
+            held[i] = NULL;
+        } else {
+            child = held[i];
+        }
     }
 
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (held[i]) { held[k++] = held[i]; }
+    }
+    return k;
 }
 
 void lenv_put(lenv* e, lval* k, lval* v) {
     
-    /* Iterate over all items in environment */
-    /* This is to see if variable already exists */
-    for (int i = 0; i < e->count; i++) {
-        /* If variable is found delete item at that position */
-        /* And replace with variable supplied by user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    /* See if variable already exists */
+    /* If so delete the old value and replace it with the one supplied */
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) {
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_copy(v);
+        return;
     }
     
     /* If no existing entry found allocate space for new entry */
@@ -463,10 +1396,17 @@ void lenv_put(lenv* e, lval* k, lval* v) {
     e->vals = realloc(e->vals, sizeof(lval*) * e->count);
     e->syms = realloc(e->syms, sizeof(char*) * e->count);
     
-    /* Copy contents of lval and symbol string into new location */
+    /* Share the value, the interned symbol is stored as is */
     e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    e->syms[e->count-1] = k->sym;
+    lenv_link(e, k->sym, e->count-1);
+
+    /* Keep the load factor of the index at or below one half */
+    if (e->index && e->count * 2 <= e->buckets) {
+        lenv_index(e, e->count-1);
+    } else if (e->count > LENV_HASH_MIN) {
+        lenv_reindex(e);
+    }
 }
 
 void lenv_def(lenv* env, lval* sym, lval* val) {
@@ -477,417 +1417,1527 @@ void lenv_def(lenv* env, lval* sym, lval* val) {
     lenv_put(env, sym, val);
 }
 
+/* Garbage Collection */
+
+/* Reference counts free most values as soon as they are dropped. The     */
+/* collector owns every lval and lenv through the pools and reclaims what */
+/* counting cannot: cycles and references lost by builtins. It marks from */
+/* the global environment and the root stack, then sweeps every unmarked  */
+/* slot without touching reference counts.                                */
+/*                                                                        */
+/* Values on the C stack are not visible to the collector, so it only    */
+/* runs when the outermost top-level form finishes. Callers holding       */
+/* values across forms, like 'load' with its unread expressions, push     */
+/* them on the root stack.                                                */
+
+#ifndef GC_MIN_OBJECTS
+#define GC_MIN_OBJECTS 65536
+#endif
+
+lenv* gc_env = NULL;
+lval** gc_roots = NULL;
+int gc_nroots = 0;
+int gc_threshold = GC_MIN_OBJECTS;
+
+void gc_root(lval* v) {
+    gc_nroots++;
+    gc_roots = realloc(gc_roots, sizeof(lval*) * gc_nroots);
+    gc_roots[gc_nroots-1] = v;
+}
+
+void gc_unroot(void) {
+    gc_nroots--;
+}
+
+bool gc_mark(lpool* p, void* x) {
+    lslab* s = lslab_of(x);
+    int i = lslab_index(p, x);
+    if (s->marked[i / 8] & (1 << (i % 8))) { return false; }
+    s->marked[i / 8] |= 1 << (i % 8);
+    return true;
+}
+
+void gc_mark_env(lenv* e);
+void gc_mark_val(lval* v);
+
+/* List storage is marked once per collection, however many views share it */
+unsigned gc_epoch = 0;
+
+void gc_mark_buf(lbuf* b) {
+    if (b->mark == gc_epoch) { return; }
+    b->mark = gc_epoch;
+    for (int i = b->lo; i < b->hi; i++) { gc_mark_val(b->slots[i]); }
+}
+
+void gc_mark_val(lval* v) {
+    if (lval_is_immediate(v) || !gc_mark(&lval_pool, v)) { return; }
+
+    switch (v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (v->buf) { gc_mark_buf(v->buf); break; }
+            for (int i = 0; i < v->count; i++) { gc_mark_val(v->cell[i]); }
+            break;
+        case LVAL_FUN:
+            if (!v->builtin) {
+                for (int i = 0; i < v->count; i++) { gc_mark_val(v->cell[i]); }
+                gc_mark_val(v->formals);
+                gc_mark_val(v->body);
+                if (v->code) {
+                    for (int i = 0; i < v->code->nconsts; i++) {
+                        gc_mark_val(v->code->consts[i]);
+                    }
+                }
+            }
+            break;
+        case LVAL_STRUCT:
+        case LVAL_INST:
+            if (v->fields) { gc_mark_val(v->fields); }
+            break;
+    }
+}
+
+/* Parents are bound afresh on every call, so they are not followed */
+void gc_mark_env(lenv* e) {
+    if (!gc_mark(&lenv_pool, e)) { return; }
+    for (int i = 0; i < e->count; i++) { gc_mark_val(e->vals[i]); }
+}
+
+/* Release what an unreachable object owns, but not the objects it points */
+/* to: those are either unreachable too or still owned elsewhere.         */
+void lcode_release(lcode* c, bool consts);
+
+void gc_free_val(lval* v) {
+    switch (v->type) {
+        case LVAL_FUN:
+            if (!v->builtin) {
+                free(v->cell);
+                if (v->code) { lcode_release(v->code, false); }
+            }
+            break;
+        case LVAL_ERR: free(v->err); break;
+        case LVAL_BIG: free(v->digits); break;
+        case LVAL_ARRAY: free(v->ints); break;
+        case LVAL_STR:
+            lval_hcons_forget(v);
+            if (!lval_str_small(v)) { lstrbuf_del(v->sbuf); }
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lval_hcons_forget(v);
+            /* Storage is malloc'd, not pooled, so drop this view's claim */
+            if (v->buf) {
+                if (--v->buf->rc == 0) { free(v->buf->slots); free(v->buf); }
+            } else {
+                free(v->cell);
+            }
+            break;
+    }
+    lpool_free(&lval_pool, v);
+}
+
+void gc_free_env(lenv* e) {
+    lenv_unlink(e);
+    free(e->syms);
+    free(e->vals);
+    free(e->index);
+    lpool_free(&lenv_pool, e);
+}
+
+void gc_sweep(lpool* p, lslab* s, void (*finalize)(void*)) {
+    for (; s; s = s->next) {
+        for (int i = 0; i < LSLAB_SLOTS; i++) {
+            int bit = 1 << (i % 8);
+            if ((s->used[i / 8] & bit) && !(s->marked[i / 8] & bit)) {
+                finalize((char*)s + LSLAB_HEADER + i * p->size);
+            }
+        }
+        memset(s->marked, 0, sizeof(s->marked));
+    }
+}
+
+void gc_collect(void) {
+    gc_epoch++;
+    if (gc_env) { gc_mark_env(gc_env); }
+    for (int i = 0; i < gc_nroots; i++) { gc_mark_val(gc_roots[i]); }
+
+    gc_sweep(&lval_pool, lval_pool.slabs, (void (*)(void*))gc_free_val);
+    gc_sweep(&lval_pool, lval_pool.arena, (void (*)(void*))gc_free_val);
+    gc_sweep(&lenv_pool, lenv_pool.slabs, (void (*)(void*))gc_free_env);
+    gc_sweep(&lenv_pool, lenv_pool.arena, (void (*)(void*))gc_free_env);
+
+    int live = lval_pool.live + lenv_pool.live;
+    gc_threshold = live * 2 > GC_MIN_OBJECTS ? live * 2 : GC_MIN_OBJECTS;
+}
+
+/* Top-level forms are bracketed by gc_enter and gc_leave. Leaving the */
+/* outermost one is the safe point for collecting and for arenas.      */
+
+void gc_enter(void) {
+    lpool_depth++;
+}
+
+void gc_leave(void) {
+    if (--lpool_depth > 0) { return; }
+
+    if (lval_pool.live + lenv_pool.live > gc_threshold) { gc_collect(); }
+
+    if (LPOOL_ARENA) {
+        lpool_release(&lval_pool);
+        lpool_release(&lenv_pool);
+    }
+}
+
 /* Builtins */
 
-#define LASSERT(args, cond, fmt, ...) \
-    if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
+/* Builtins borrow their arguments: args points at argc values that stay */
+/* owned by the caller, and the result is a new reference.               */
+
+#define LASSERT(cond, fmt, ...) \
+    if (!(cond)) { return lval_err(fmt, ##__VA_ARGS__); }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(lval_type(args[index]) == expect, \
         "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-        func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+        func, index, ltype_name(lval_type(args[index])), ltype_name(expect))
 
-#define LASSERT_NUM(func, args, num) \
-    LASSERT(args, args->count == num, \
+#define LASSERT_NUM(func, argc, num) \
+    LASSERT(argc == num, \
         "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
-        func, args->count, num)
+        func, argc, num)
 
 #define LASSERT_NOT_EMPTY(func, args, index) \
-    LASSERT(args, args->cell[index]->count != 0, \
+    LASSERT(args[index]->count != 0, \
         "Function '%s' passed {} for argument %i.", func, index);
 
 lval* lval_eval(lenv* e, lval* v);
+lval* lval_eval_code(lenv* e, lval* v);
+lval* lval_eval_sexpr(lenv* e, lval* v);
+lval* lval_apply(lenv* e, lval* v);
+lval* lval_if(lenv* e, lval** args, int argc, lval** branch);
+bool lval_truth(lval* x);
+
+/* Lexical addressing. A lambda's frame holds its formals in order, each */
+/* name once and '&' skipped, so when the lambda is created every symbol */
+/* in its body is tagged with the slot its name will occupy. Evaluation  */
+/* reads that slot directly if the frame really binds the symbol there,  */
+/* and falls back to a lookup by name otherwise. The slot is only a hint */
+/* and does not change what a symbol means, so shared nodes are updated  */
+/* in place. Only the lambda's own frame is addressed: its parent is the */
+/* caller's environment, which is not known until the call.             */
+
+int lval_slot(lval* formals, char* sym) {
+    int slot = 0;
+    for (int i = 0; i < formals->count; i++) {
+        char* name = formals->cell[i]->sym;
+        if (name == lsym_amp) { continue; }
+
+        /* A repeated name rebinds the slot of its first occurrence */
+        int first = i;
+        for (int j = 0; j < i; j++) {
+            if (formals->cell[j]->sym == name) { first = j; break; }
+        }
+        if (first != i) { continue; }
+
+        if (name == sym) { return slot; }
+        slot++;
+    }
+    return -1;
+}
+
+void lval_resolve(lval* v, lval* formals) {
+    switch (lval_type(v)) {
+        case LVAL_SYM:
+            v->slot = lval_slot(formals, v->sym);
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) {
+                lval_resolve(v->cell[i], formals);
+            }
+            break;
+    }
+}
+
+lcode* lcode_compile(lval* formals, lval* body);
 
-lval* builtin_lambda(lenv* e, lval* a) {
-    LASSERT_NUM("lambda", a, 2);
-    LASSERT_TYPE("lambda", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("lambda", a, 1, LVAL_QEXPR);
+lval* builtin_lambda(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("lambda", argc, 2);
+    LASSERT_TYPE("lambda", args, 0, LVAL_QEXPR);
+    LASSERT_TYPE("lambda", args, 1, LVAL_QEXPR);
 
-    for (int i=0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM), 
+    for (int i=0; i < args[0]->count; i++) {
+        LASSERT((lval_type(args[0]->cell[i]) == LVAL_SYM), 
         "Cannot define a non-symbol. Got %s, expected %s",
-        ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+        ltype_name(lval_type(args[0]->cell[i])), ltype_name(LVAL_SYM));
     }
     
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
+    lval* formals = lval_copy(args[0]);
+    lval* body = lval_copy(args[1]);
 
-    return lval_lambda(formals, body);
+    lval_resolve(body, formals);
+    lval* f = lval_lambda(formals, body);
+    if (LVAL_VM) { f->code = lcode_compile(formals, body); }
+    return f;
 }
 
-lval* builtin_list(lenv* e, lval* a) {
-    a->type = LVAL_QEXPR;
-    return a;
+/* A new Q-expression sharing the values of args */
+lval* lval_list(lval** args, int argc) {
+    lval* x = lval_qexpr();
+    lval_reserve(x, argc);
+    x->count = argc;
+    for (int i = 0; i < argc; i++) {
+        x->cell[i] = lval_copy(args[i]);
+    }
+    return x;
 }
 
-lval* builtin_first(lenv* e, lval* a) {
-    LASSERT_NUM("first", a, 1);
-    LASSERT_TYPE("first", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("first", a, 0);
+lval* builtin_list(lenv* e, lval** args, int argc) {
+    return lval_list(args, argc);
+}
+
+lval* builtin_first(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("first", argc, 1);
+    LASSERT_TYPE("first", args, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("first", args, 0);
     
-    lval* v = lval_take(a, 0);
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v->cell[0];
+    return lval_copy(args[0]->cell[0]);
 }
 
-lval* builtin_rest(lenv* e, lval* a) {
-    LASSERT_NUM("rest", a, 1);
-    LASSERT_TYPE("rest", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("rest", a, 0);
+lval* builtin_rest(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("rest", argc, 1);
+    LASSERT_TYPE("rest", args, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("rest", args, 0);
 
-    lval* v = lval_take(a, 0);    
-    lval_del(lval_pop(v, 0));
-    return v;
+    return lval_slice(args[0], 1, args[0]->count - 1);
 }
 
-lval* builtin_last(lenv* e, lval* a) {
-    LASSERT_NUM("last", a, 1);
-    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("last", a, 0);
+lval* builtin_take(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("take", argc, 2);
+    LASSERT_TYPE("take", args, 0, LVAL_NUM);
+    LASSERT_TYPE("take", args, 1, LVAL_QEXPR);
 
-    lval* v = a->cell[0]->cell[a->cell[0]->count - 1];
-    return v;
+    long n = lval_number(args[0]);
+    if (n < 0) { n = 0; }
+    if (n > args[1]->count) { n = args[1]->count; }
+    return lval_slice(args[1], 0, n);
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
-    LASSERT_NUM("eval", a, 1);
-    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+lval* builtin_drop(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("drop", argc, 2);
+    LASSERT_TYPE("drop", args, 0, LVAL_NUM);
+    LASSERT_TYPE("drop", args, 1, LVAL_QEXPR);
+
+    long n = lval_number(args[0]);
+    if (n < 0) { n = 0; }
+    if (n > args[1]->count) { n = args[1]->count; }
+    return lval_slice(args[1], n, args[1]->count - n);
+}
+
+lval* builtin_last(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("last", argc, 1);
+    LASSERT_TYPE("last", args, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("last", args, 0);
+
+    return lval_copy(args[0]->cell[args[0]->count - 1]);
+}
+
+lval* builtin_eval(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("eval", argc, 1);
+    LASSERT_TYPE("eval", args, 0, LVAL_QEXPR);
     
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return lval_eval_sexpr(e, args[0]);
 }
 
-lval* builtin_join(lenv* e, lval* a) {
+lval* builtin_join(lenv* e, lval** args, int argc) {
     
-    for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+    for (int i = 0; i < argc; i++) {
+        LASSERT_TYPE("join", args, i, LVAL_QEXPR);
     }
+
+    if (argc == 0) { return lval_qexpr(); }
     
-    lval* x = lval_pop(a, 0);
-    
-    while (a->count) {
-        lval* y = lval_pop(a, 0);
-        x = lval_join(x, y);
+    /* Each step appends onto the list the previous one made */
+    lval* x = lval_copy(args[0]);
+    for (int i = 1; i < argc; i++) {
+        lval* y = lval_append(x, args[i]->cell, args[i]->count);
+        lval_del(x);
+        x = y;
     }
     
-    lval_del(a);
     return x;
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
-    
-    for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+/* Bignums                                                                 */
+/*                                                                         */
+/* Integer arithmetic runs on longs, with the checked-arithmetic builtins  */
+/* catching any step that overflows. That step, and any step that meets an */
+/* operand which is already a bignum, carries on here. Digits are base 1e9 */
+/* so reading and printing are cheap. A result that fits a long is turned  */
+/* back into one, so each integer has exactly one representation.         */
+/* Products of long operands use Karatsuba's method, which needs three     */
+/* half-size products where the schoolbook method needs four.              */
+
+#define LBIG_BASE 1000000000u
+#define LBIG_KARATSUBA 32
+
+/* An integer operand seen as digits, however it is stored */
+typedef struct {
+    uint32_t* d;
+    int n;
+    int sign;
+    uint32_t small[3];
+} lbig;
+
+void lbig_load(lbig* b, lval* v) {
+    if (lval_type(v) == LVAL_BIG) {
+        b->d = v->digits;
+        b->n = v->ndigits;
+        b->sign = v->sign;
+        return;
     }
-    
-    lval* x = lval_pop(a, 0);
-    
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+
+    long x = lval_number(v);
+    unsigned long m = x < 0 ? -(unsigned long)x : (unsigned long)x;
+    b->d = b->small;
+    b->n = 0;
+    b->sign = x < 0 ? -1 : 1;
+    while (m) {
+        b->small[b->n++] = m % LBIG_BASE;
+        m /= LBIG_BASE;
     }
-    
-    while (a->count > 0) {    
-        lval* y = lval_pop(a, 0);
-        
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero.");
-                break;
+}
+
+/* The integer of n digits in d with the given sign. Takes d. */
+lval* lbig_result(uint32_t* d, int n, int sign) {
+    while (n > 0 && d[n - 1] == 0) { n--; }
+
+    if (n <= 3) {
+        unsigned long m = 0;
+        bool fits = true;
+        for (int i = n - 1; i >= 0 && fits; i--) {
+            fits = m <= (ULONG_MAX - d[i]) / LBIG_BASE;
+            m = m * LBIG_BASE + d[i];
+        }
+        if (fits && m <= (sign > 0 ? (unsigned long)LONG_MAX : (unsigned long)LONG_MAX + 1)) {
+            free(d);
+            return lval_num(sign > 0 || m == 0 ? (long)m : -(long)(m - 1) - 1);
+        }
+    }
+
+    lval* v = lval_new(LVAL_BIG);
+    v->digits = d;
+    v->ndigits = n;
+    v->sign = sign;
+    return v;
+}
+
+int lbig_cmp_mag(uint32_t* a, int na, uint32_t* b, int nb) {
+    if (na != nb) { return na < nb ? -1 : 1; }
+    for (int i = na - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+/* r = a + b, where r has room for one digit more than the longer */
+int lbig_add_mag(uint32_t* r, uint32_t* a, int na, uint32_t* b, int nb) {
+    if (na < nb) {
+        uint32_t* t = a; a = b; b = t;
+        int n = na; na = nb; nb = n;
+    }
+
+    uint32_t carry = 0;
+    for (int i = 0; i < na; i++) {
+        uint32_t t = a[i] + (i < nb ? b[i] : 0) + carry;
+        carry = t >= LBIG_BASE;
+        r[i] = carry ? t - LBIG_BASE : t;
+    }
+    r[na] = carry;
+    return na + 1;
+}
+
+/* r = a - b, where a >= b. r may be a. */
+void lbig_sub_mag(uint32_t* r, uint32_t* a, int na, uint32_t* b, int nb) {
+    int borrow = 0;
+    for (int i = 0; i < na; i++) {
+        int64_t t = (int64_t)a[i] - (i < nb ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = borrow ? t + LBIG_BASE : t;
+    }
+}
+
+/* r += a, where the sum fits in the nr digits of r */
+void lbig_add_into(uint32_t* r, int nr, uint32_t* a, int na) {
+    while (na > 0 && a[na - 1] == 0) { na--; }
+
+    uint32_t carry = 0;
+    for (int i = 0; i < nr && (i < na || carry); i++) {
+        uint32_t t = r[i] + (i < na ? a[i] : 0) + carry;
+        carry = t >= LBIG_BASE;
+        r[i] = carry ? t - LBIG_BASE : t;
+    }
+}
+
+/* r = a * f for a single digit f, where r has room for na + 1 digits */
+void lbig_mul_small(uint32_t* r, uint32_t* a, int na, uint32_t f) {
+    uint64_t carry = 0;
+    for (int i = 0; i < na; i++) {
+        uint64_t t = (uint64_t)a[i] * f + carry;
+        r[i] = t % LBIG_BASE;
+        carry = t / LBIG_BASE;
+    }
+    r[na] = carry;
+}
+
+/* r = a * b, where r is na + nb zeroed digits */
+void lbig_mul_mag(uint32_t* r, uint32_t* a, int na, uint32_t* b, int nb) {
+    if (na < nb) {
+        uint32_t* t = a; a = b; b = t;
+        int n = na; na = nb; nb = n;
+    }
+
+    if (nb < LBIG_KARATSUBA) {
+        for (int i = 0; i < nb; i++) {
+            uint64_t carry = 0;
+            for (int j = 0; j < na; j++) {
+                uint64_t t = (uint64_t)b[i] * a[j] + r[i + j] + carry;
+                r[i + j] = t % LBIG_BASE;
+                carry = t / LBIG_BASE;
             }
-            x->num /= y->num;
+            r[i + na] = carry;
+        }
+        return;
+    }
+
+    /* Much the longer a is multiplied by b a piece of the same size at a time */
+    if (na >= 2 * nb) {
+        uint32_t* t = malloc(sizeof(uint32_t) * 2 * nb);
+        for (int i = 0; i < na; i += nb) {
+            int k = na - i < nb ? na - i : nb;
+            memset(t, 0, sizeof(uint32_t) * (k + nb));
+            lbig_mul_mag(t, a + i, k, b, nb);
+            lbig_add_into(r + i, na + nb - i, t, k + nb);
+        }
+        free(t);
+        return;
+    }
+
+    /* With a = a1 B^m + a0 and b = b1 B^m + b0, a b is z2 B^2m + z1 B^m + z0 */
+    /* where z2 = a1 b1, z0 = a0 b0 and z1 = (a1 + a0)(b1 + b0) - z2 - z0.    */
+    int m = na / 2;
+    int n1 = na - m;
+    int n2 = nb - m;
+
+    uint32_t* z0 = calloc(2 * m, sizeof(uint32_t));
+    uint32_t* z2 = calloc(n1 + n2, sizeof(uint32_t));
+    lbig_mul_mag(z0, a, m, b, m);
+    lbig_mul_mag(z2, a + m, n1, b + m, n2);
+
+    uint32_t* sa = malloc(sizeof(uint32_t) * (n1 + 1));
+    uint32_t* sb = malloc(sizeof(uint32_t) * ((m > n2 ? m : n2) + 1));
+    int nsa = lbig_add_mag(sa, a, m, a + m, n1);
+    int nsb = lbig_add_mag(sb, b, m, b + m, n2);
+
+    int nz1 = nsa + nsb;
+    uint32_t* z1 = calloc(nz1, sizeof(uint32_t));
+    lbig_mul_mag(z1, sa, nsa, sb, nsb);
+    lbig_sub_mag(z1, z1, nz1, z0, 2 * m);
+    lbig_sub_mag(z1, z1, nz1, z2, n1 + n2);
+
+    lbig_add_into(r, na + nb, z0, 2 * m);
+    lbig_add_into(r + m, na + nb - m, z1, nz1);
+    lbig_add_into(r + 2 * m, na + nb - 2 * m, z2, n1 + n2);
+
+    free(z0);
+    free(z1);
+    free(z2);
+    free(sa);
+    free(sb);
+}
+
+lval* lbig_add(lbig* a, lbig* b, int bsign) {
+    int n = (a->n > b->n ? a->n : b->n) + 1;
+    uint32_t* r = calloc(n, sizeof(uint32_t));
+
+    if (a->sign == bsign) {
+        lbig_add_mag(r, a->d, a->n, b->d, b->n);
+        return lbig_result(r, n, a->sign);
+    }
+    if (lbig_cmp_mag(a->d, a->n, b->d, b->n) >= 0) {
+        lbig_sub_mag(r, a->d, a->n, b->d, b->n);
+        return lbig_result(r, n, a->sign);
+    }
+    lbig_sub_mag(r, b->d, b->n, a->d, a->n);
+    return lbig_result(r, n, bsign);
+}
+
+lval* lbig_mul(lbig* a, lbig* b) {
+    int n = a->n + b->n;
+    uint32_t* r = calloc(n ? n : 1, sizeof(uint32_t));
+    lbig_mul_mag(r, a->d, a->n, b->d, b->n);
+    return lbig_result(r, n, a->sign * b->sign);
+}
+
+/* a / b rounded towards zero, as for longs, by Knuth's algorithm D */
+lval* lbig_div(lbig* a, lbig* b) {
+    int sign = a->sign * b->sign;
+    if (lbig_cmp_mag(a->d, a->n, b->d, b->n) < 0) { return lval_num(0); }
+
+    int n = b->n;
+    int m = a->n - n;
+    uint32_t* q = calloc(m + 1, sizeof(uint32_t));
+
+    if (n == 1) {
+        uint64_t rem = 0;
+        for (int i = a->n - 1; i >= 0; i--) {
+            uint64_t t = rem * LBIG_BASE + a->d[i];
+            q[i] = t / b->d[0];
+            rem = t % b->d[0];
+        }
+        return lbig_result(q, m + 1, sign);
+    }
+
+    /* Scale both so the top digit of the divisor is at least half the */
+    /* base, which keeps each estimated quotient digit at most 2 high. */
+    uint32_t f = LBIG_BASE / (b->d[n - 1] + 1);
+    uint32_t* u = malloc(sizeof(uint32_t) * (a->n + 1));
+    uint32_t* v = malloc(sizeof(uint32_t) * (n + 1));
+    lbig_mul_small(u, a->d, a->n, f);
+    lbig_mul_small(v, b->d, n, f);
+
+    for (int j = m; j >= 0; j--) {
+        uint64_t num = (uint64_t)u[j + n] * LBIG_BASE + u[j + n - 1];
+        uint64_t qhat = num / v[n - 1];
+        uint64_t rhat = num % v[n - 1];
+        while (qhat >= LBIG_BASE || qhat * v[n - 2] > rhat * LBIG_BASE + u[j + n - 2]) {
+            qhat--;
+            rhat += v[n - 1];
+            if (rhat >= LBIG_BASE) { break; }
+        }
+
+        /* Subtract qhat v from the current window of u */
+        uint64_t carry = 0;
+        int borrow = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t p = qhat * v[i] + carry;
+            carry = p / LBIG_BASE;
+            int64_t t = (int64_t)u[i + j] - (int64_t)(p % LBIG_BASE) - borrow;
+            borrow = t < 0;
+            u[i + j] = borrow ? t + LBIG_BASE : t;
+        }
+
+        /* Too high by one: add v back. The top digit is not read again. */
+        if ((int64_t)u[j + n] - (int64_t)carry - borrow < 0) {
+            qhat--;
+            uint32_t c = 0;
+            for (int i = 0; i < n; i++) {
+                uint32_t s = u[i + j] + v[i] + c;
+                c = s >= LBIG_BASE;
+                u[i + j] = c ? s - LBIG_BASE : s;
+            }
+        }
+        q[j] = qhat;
+    }
+
+    free(u);
+    free(v);
+    return lbig_result(q, m + 1, sign);
+}
+
+/* x op y for integers, either of which may be a bignum. Consumes x. */
+lval* lbig_op(char op, lval* x, lval* y) {
+    lbig a, b;
+    lbig_load(&a, x);
+    lbig_load(&b, y);
+
+    lval* r = NULL;
+    switch (op) {
+        case '+': r = lbig_add(&a, &b, b.sign); break;
+        case '-': r = lbig_add(&a, &b, -b.sign); break;
+        case '*': r = lbig_mul(&a, &b); break;
+        case '/': r = b.n ? lbig_div(&a, &b) : lval_err("Division By Zero."); break;
+    }
+    lval_del(x);
+    return r;
+}
+
+/* Compares two integers, either of which may be a bignum */
+int lval_cmp_int(lval* x, lval* y) {
+    if (lval_type(x) == LVAL_NUM && lval_type(y) == LVAL_NUM) {
+        long a = lval_number(x);
+        long b = lval_number(y);
+        return (a > b) - (a < b);
+    }
+
+    lbig a, b;
+    lbig_load(&a, x);
+    lbig_load(&b, y);
+    int sa = a.n ? a.sign : 0;
+    int sb = b.n ? b.sign : 0;
+    if (sa != sb) { return sa < sb ? -1 : 1; }
+    int c = lbig_cmp_mag(a.d, a.n, b.d, b.n);
+    return sa < 0 ? -c : c;
+}
+
+/* Checked arithmetic. Each sets *r to x op y and returns false, or */
+/* returns true, leaving *r alone, if the result does not fit in T. */
+
+#ifdef __GNUC__
+#define LVAL_CHECKED(name, T, MIN, MAX) \
+    bool name##_add(T x, T y, T* r) { return __builtin_add_overflow(x, y, r); } \
+    bool name##_sub(T x, T y, T* r) { return __builtin_sub_overflow(x, y, r); } \
+    bool name##_mul(T x, T y, T* r) { return __builtin_mul_overflow(x, y, r); }
+#else
+#define LVAL_CHECKED(name, T, MIN, MAX) \
+    bool name##_add(T x, T y, T* r) { \
+        if (y > 0 ? x > MAX - y : x < MIN - y) { return true; } \
+        *r = x + y; \
+        return false; \
+    } \
+    \
+    bool name##_sub(T x, T y, T* r) { \
+        if (y < 0 ? x > MAX + y : x < MIN + y) { return true; } \
+        *r = x - y; \
+        return false; \
+    } \
+    \
+    bool name##_mul(T x, T y, T* r) { \
+        if (x > 0 ? (y > 0 ? x > MAX / y : y < MIN / x) \
+                  : (y > 0 ? x < MIN / y : x != 0 && y < MAX / x)) { return true; } \
+        *r = x * y; \
+        return false; \
+    }
+#endif
+
+LVAL_CHECKED(lchk_long, long, LONG_MIN, LONG_MAX)
+LVAL_CHECKED(lchk_i64, int64_t, INT64_MIN, INT64_MAX)
+
+/* Folds op over integer operands, in a long for as long as it fits */
+lval* lval_int_fold(char op, lval** args, int argc) {
+    if (op == '-' && argc == 1) {
+        long r;
+        if (lval_type(args[0]) == LVAL_NUM && !lchk_long_sub(0, lval_number(args[0]), &r)) {
+            return lval_num(r);
+        }
+        return lbig_op('-', lval_num(0), args[0]);
+    }
+
+    int i = 0;
+    long x = 0;
+    if (lval_type(args[0]) == LVAL_NUM) {
+        x = lval_number(args[0]);
+        for (i = 1; i < argc && lval_type(args[i]) == LVAL_NUM; i++) {
+            long y = lval_number(args[i]);
+            long r = 0;
+            bool over = false;
+            switch (op) {
+                case '+': over = lchk_long_add(x, y, &r); break;
+                case '-': over = lchk_long_sub(x, y, &r); break;
+                case '*': over = lchk_long_mul(x, y, &r); break;
+                case '/':
+                    if (y == 0) { return lval_err("Division By Zero."); }
+                    over = x == LONG_MIN && y == -1;
+                    if (!over) { r = x / y; }
+                    break;
+            }
+            if (over) { break; }
+            x = r;
+        }
+        if (i == argc) { return lval_num(x); }
+    }
+
+    /* Carry on in bignums from the first step that did not fit */
+    lval* acc = i ? lval_num(x) : lval_copy(args[0]);
+    for (i = i ? i : 1; i < argc; i++) {
+        acc = lbig_op(op, acc, args[i]);
+        if (lval_type(acc) == LVAL_ERR) { break; }
+    }
+    return acc;
+}
+
+/* Arrays                                                                  */
+/*                                                                         */
+/* An array holds count integers or count doubles in one contiguous block, */
+/* so whole-array operations run over plain machine numbers rather than    */
+/* chasing a pointer per element. Unlike lists, arrays change in place:    */
+/* 'aset' is seen through every reference to the array. Integer elements   */
+/* are 64 bits wide. 'sum' and 'dot' go to bignums when their total does   */
+/* not fit, as scalar arithmetic does, but an element of '+' or '*' must   */
+/* fit in 64 bits and a result that does not is an error.                  */
+/*                                                                         */
+/* With GCC the kernels below use vector types: 32 bytes wide for AVX2     */
+/* when the target has it, and 16 bytes otherwise, which is SSE2 on x86-64 */
+/* and is lowered to scalar code where there is no vector unit. Scalar     */
+/* loops finish the elements left over, and do all the work if LVAL_SIMD   */
+/* is 0. Vector sums add floats in a different order than a loop would, so */
+/* they can differ from one in the last bits. Integer sums are checked for */
+/* overflow lane by lane. No vector unit short of AVX-512 multiplies      */
+/* 64-bit integers, so integer products are checked one at a time.         */
+
+#ifndef LVAL_SIMD
+#ifdef __GNUC__
+#define LVAL_SIMD 1
+#else
+#define LVAL_SIMD 0
+#endif
+#endif
+
+#if LVAL_SIMD
+#ifdef __AVX2__
+#define LVAL_VECTOR 32
+#else
+#define LVAL_VECTOR 16
+#endif
+
+typedef uint64_t lvec_int __attribute__((vector_size(LVAL_VECTOR)));
+typedef double lvec_dbl __attribute__((vector_size(LVAL_VECTOR)));
+
+/* Elements per vector, for both kinds */
+#define LVEC_LANES (LVAL_VECTOR / 8)
+#endif
+
+double lkern_sum_dbl(double* x, int n) {
+    int i = 0;
+    double s = 0;
+#if LVAL_SIMD
+    lvec_dbl acc = {0};
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_dbl a;
+        memcpy(&a, x + i, sizeof(a));
+        acc += a;
+    }
+    for (int j = 0; j < LVEC_LANES; j++) { s += acc[j]; }
+#endif
+    for (; i < n; i++) { s += x[i]; }
+    return s;
+}
+
+double lkern_dot_dbl(double* x, double* y, int n) {
+    int i = 0;
+    double s = 0;
+#if LVAL_SIMD
+    lvec_dbl acc = {0};
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_dbl a, b;
+        memcpy(&a, x + i, sizeof(a));
+        memcpy(&b, y + i, sizeof(b));
+        acc += a * b;
+    }
+    for (int j = 0; j < LVEC_LANES; j++) { s += acc[j]; }
+#endif
+    for (; i < n; i++) { s += x[i] * y[i]; }
+    return s;
+}
+
+/* r = x op y for + or *, or x op y[0] for every element if splat is set */
+void lkern_zip_dbl(char op, double* r, double* x, double* y, bool splat, int n) {
+    int i = 0;
+#if LVAL_SIMD
+    lvec_dbl k = {0};
+    k += y[0];
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_dbl a, b = k;
+        memcpy(&a, x + i, sizeof(a));
+        if (!splat) { memcpy(&b, y + i, sizeof(b)); }
+        if (op == '+') { a += b; } else { a *= b; }
+        memcpy(r + i, &a, sizeof(a));
+    }
+#endif
+    for (; i < n; i++) {
+        double b = y[splat ? 0 : i];
+        r[i] = op == '+' ? x[i] + b : x[i] * b;
+    }
+}
+
+/* Integer kernels return true on overflow. A vector lane adds modulo  */
+/* 2^64, and it overflowed if the result's sign differs from the signs */
+/* of both operands, which is collected over the whole loop.           */
+
+bool lkern_sum_int(int64_t* x, int n, int64_t* r) {
+    int i = 0;
+    int64_t s = 0;
+#if LVAL_SIMD
+    lvec_int acc = {0};
+    lvec_int over = {0};
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_int a;
+        memcpy(&a, x + i, sizeof(a));
+        lvec_int t = acc + a;
+        over |= (acc ^ t) & (a ^ t);
+        acc = t;
+    }
+    for (int j = 0; j < LVEC_LANES; j++) {
+        if (over[j] >> 63 || lchk_i64_add(s, (int64_t)acc[j], &s)) { return true; }
+    }
+#endif
+    for (; i < n; i++) {
+        if (lchk_i64_add(s, x[i], &s)) { return true; }
+    }
+    *r = s;
+    return false;
+}
+
+bool lkern_dot_int(int64_t* x, int64_t* y, int n, int64_t* r) {
+    int64_t s = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t p;
+        if (lchk_i64_mul(x[i], y[i], &p) || lchk_i64_add(s, p, &s)) { return true; }
+    }
+    *r = s;
+    return false;
+}
+
+bool lkern_zip_int(char op, int64_t* r, int64_t* x, int64_t* y, bool splat, int n) {
+    int i = 0;
+    if (op == '*') {
+        for (; i < n; i++) {
+            if (lchk_i64_mul(x[i], y[splat ? 0 : i], &r[i])) { return true; }
+        }
+        return false;
+    }
+
+#if LVAL_SIMD
+    lvec_int over = {0};
+    lvec_int k = {0};
+    k += (uint64_t)y[0];
+    for (; i + LVEC_LANES <= n; i += LVEC_LANES) {
+        lvec_int a, b = k;
+        memcpy(&a, x + i, sizeof(a));
+        if (!splat) { memcpy(&b, y + i, sizeof(b)); }
+        lvec_int t = a + b;
+        over |= (a ^ t) & (b ^ t);
+        memcpy(r + i, &t, sizeof(t));
+    }
+    for (int j = 0; j < LVEC_LANES; j++) {
+        if (over[j] >> 63) { return true; }
+    }
+#endif
+    for (; i < n; i++) {
+        if (lchk_i64_add(x[i], y[splat ? 0 : i], &r[i])) { return true; }
+    }
+    return false;
+}
+
+/* A new array of n elements of the given kind, LVAL_NUM or LVAL_DBL */
+lval* lval_array(int kind, int n) {
+    lval* v = lval_new(LVAL_ARRAY);
+    v->count = v->cap = n;
+    v->cell = NULL;
+    v->kind = kind;
+    v->ints = malloc(sizeof(int64_t) * (n ? n : 1));
+    return v;
+}
+
+/* x as a number, which is a bignum where a long is narrower than x */
+lval* lval_int64(int64_t x) {
+#if LONG_MAX < INT64_MAX
+    if (x < LONG_MIN || x > LONG_MAX) {
+        uint64_t m = x < 0 ? -(uint64_t)x : (uint64_t)x;
+        uint32_t* d = malloc(sizeof(uint32_t) * 3);
+        for (int i = 0; i < 3; i++) {
+            d[i] = m % LBIG_BASE;
+            m /= LBIG_BASE;
+        }
+        return lbig_result(d, 3, x < 0 ? -1 : 1);
+    }
+#endif
+    return lval_num((long)x);
+}
+
+lval* lval_aref(lval* a, int i) {
+    return a->kind == LVAL_DBL ? lval_dbl(a->dbls[i]) : lval_int64(a->ints[i]);
+}
+
+/* The sum of x[i] * y[i], or of x[i] if y is NULL, in bignums. This is */
+/* how 'sum' and 'dot' finish when a 64-bit total overflows.           */
+lval* lval_array_exact(int64_t* x, int64_t* y, int n) {
+    lval* acc = lval_num(0);
+    for (int i = 0; i < n; i++) {
+        lval* t = lval_int64(x[i]);
+        if (y) {
+            lval* b = lval_int64(y[i]);
+            t = lbig_op('*', t, b);
+            lval_del(b);
+        }
+        acc = lbig_op('+', acc, t);
+        lval_del(t);
+    }
+    return acc;
+}
+
+/* The elements of a as doubles, in a new block */
+double* lval_array_dbls(lval* a) {
+    double* d = malloc(sizeof(double) * (a->count ? a->count : 1));
+    for (int i = 0; i < a->count; i++) { d[i] = a->ints[i]; }
+    return d;
+}
+
+/* x op y for + or *, element by element, where x or y is an array and  */
+/* the other is an array of the same length or a number to apply to each */
+lval* lval_array_zip(char op, lval* x, lval* y) {
+    if (lval_type(x) != LVAL_ARRAY) { lval* t = x; x = y; y = t; }
+
+    int yarr = lval_type(y) == LVAL_ARRAY;
+    int ykind = yarr ? y->kind : lval_type(y);
+    if (yarr) {
+        LASSERT(x->count == y->count,
+            "Function '%c' passed arrays of different lengths. Got %i and %i.",
+            op, x->count, y->count);
+    } else {
+        LASSERT(ykind == LVAL_NUM || ykind == LVAL_DBL,
+            "Function '%c' passed incorrect type for an array operand. Got %s, Expected Number.",
+            op, ltype_name(ykind));
+    }
+
+    int n = x->count;
+    int kind = x->kind == LVAL_DBL || ykind == LVAL_DBL ? LVAL_DBL : LVAL_NUM;
+    lval* r = lval_array(kind, n);
+
+    if (kind == LVAL_NUM) {
+        int64_t k = yarr ? 0 : lval_number(y);
+        if (lkern_zip_int(op, r->ints, x->ints, yarr ? y->ints : &k, !yarr, n)) {
+            lval_del(r);
+            return lval_err("Function '%c' overflowed a 64-bit array element.", op);
+        }
+        return r;
+    }
+
+    /* Integer operands are widened to doubles first */
+    double k = yarr ? 0 : lval_double(y);
+    double* xs = x->kind == LVAL_DBL ? x->dbls : lval_array_dbls(x);
+    double* ys = !yarr ? &k : y->kind == LVAL_DBL ? y->dbls : lval_array_dbls(y);
+    lkern_zip_dbl(op, r->dbls, xs, ys, !yarr, n);
+    if (xs != x->dbls) { free(xs); }
+    if (yarr && ys != y->dbls) { free(ys); }
+    return r;
+}
+
+int lval_any_array(lval** args, int argc) {
+    for (int i = 0; i < argc; i++) {
+        if (lval_type(args[i]) == LVAL_ARRAY) { return 1; }
+    }
+    return 0;
+}
+
+lval* builtin_add(lenv* e, lval** args, int argc);
+lval* builtin_mul(lenv* e, lval** args, int argc);
+
+/* Folds + or * over operands of which at least one is an array */
+lval* lval_array_fold(char op, lval** args, int argc) {
+    lval* x = lval_copy(args[0]);
+    for (int i = 1; i < argc; i++) {
+        lval* r;
+        if (lval_type(x) == LVAL_ARRAY || lval_type(args[i]) == LVAL_ARRAY) {
+            r = lval_array_zip(op, x, args[i]);
+        } else {
+            lval* pair[2] = { x, args[i] };
+            r = op == '+' ? builtin_add(NULL, pair, 2) : builtin_mul(NULL, pair, 2);
+        }
+        lval_del(x);
+        if (lval_type(r) == LVAL_ERR) { return r; }
+        x = r;
+    }
+    return x;
+}
+
+/* (array {1 2 3}) makes an array of the numbers in a list: of doubles */
+/* if any of them is a float, and of integers otherwise.               */
+lval* builtin_array(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("array", argc, 1);
+    LASSERT_TYPE("array", args, 0, LVAL_QEXPR);
+
+    lval* l = args[0];
+    int kind = LVAL_NUM;
+    for (int i = 0; i < l->count; i++) {
+        int t = lval_type(l->cell[i]);
+        LASSERT(t == LVAL_NUM || t == LVAL_DBL,
+            "Function 'array' passed incorrect type for element %i. Got %s, Expected %s.",
+            i, ltype_name(t), ltype_name(LVAL_NUM));
+        if (t == LVAL_DBL) { kind = LVAL_DBL; }
+    }
+
+    lval* a = lval_array(kind, l->count);
+    for (int i = 0; i < l->count; i++) {
+        if (kind == LVAL_DBL) { a->dbls[i] = lval_double(l->cell[i]); }
+        else { a->ints[i] = lval_number(l->cell[i]); }
+    }
+    return a;
+}
+
+#define LASSERT_INDEX(func, args, index) \
+    LASSERT(lval_number(args[index]) >= 0 && lval_number(args[index]) < args[0]->count, \
+        "Function '%s' passed index %li for an array of length %i.", \
+        func, lval_number(args[index]), args[0]->count)
+
+lval* builtin_aref(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("aref", argc, 2);
+    LASSERT_TYPE("aref", args, 0, LVAL_ARRAY);
+    LASSERT_TYPE("aref", args, 1, LVAL_NUM);
+    LASSERT_INDEX("aref", args, 1);
+
+    return lval_aref(args[0], lval_number(args[1]));
+}
+
+/* (aset a i x) stores x at index i of a, in place, and returns a */
+lval* builtin_aset(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("aset", argc, 3);
+    LASSERT_TYPE("aset", args, 0, LVAL_ARRAY);
+    LASSERT_TYPE("aset", args, 1, LVAL_NUM);
+    LASSERT_INDEX("aset", args, 1);
+
+    lval* a = args[0];
+    long i = lval_number(args[1]);
+    if (a->kind == LVAL_DBL) {
+        if (lval_type(args[2]) != LVAL_NUM) { LASSERT_TYPE("aset", args, 2, LVAL_DBL); }
+        a->dbls[i] = lval_double(args[2]);
+    } else {
+        LASSERT_TYPE("aset", args, 2, LVAL_NUM);
+        a->ints[i] = lval_number(args[2]);
+    }
+    return lval_copy(a);
+}
+
+lval* builtin_sum(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("sum", argc, 1);
+    LASSERT_TYPE("sum", args, 0, LVAL_ARRAY);
+
+    lval* a = args[0];
+    if (a->kind == LVAL_DBL) { return lval_dbl(lkern_sum_dbl(a->dbls, a->count)); }
+    int64_t r;
+    if (lkern_sum_int(a->ints, a->count, &r)) { return lval_array_exact(a->ints, NULL, a->count); }
+    return lval_int64(r);
+}
+
+lval* builtin_dot(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("dot", argc, 2);
+    LASSERT_TYPE("dot", args, 0, LVAL_ARRAY);
+    LASSERT_TYPE("dot", args, 1, LVAL_ARRAY);
+
+    lval* x = args[0];
+    lval* y = args[1];
+    LASSERT(x->count == y->count,
+        "Function 'dot' passed arrays of different lengths. Got %i and %i.",
+        x->count, y->count);
+
+    if (x->kind == LVAL_NUM && y->kind == LVAL_NUM) {
+        int64_t r;
+        if (lkern_dot_int(x->ints, y->ints, x->count, &r)) {
+            return lval_array_exact(x->ints, y->ints, x->count);
+        }
+        return lval_int64(r);
+    }
+
+    double* xs = x->kind == LVAL_DBL ? x->dbls : lval_array_dbls(x);
+    double* ys = y->kind == LVAL_DBL ? y->dbls : lval_array_dbls(y);
+    double r = lkern_dot_dbl(xs, ys, x->count);
+    if (xs != x->dbls) { free(xs); }
+    if (ys != y->dbls) { free(ys); }
+    return lval_dbl(r);
+}
+
+/* Calls f on x, which it consumes */
+lval* lval_call1(lenv* e, lval* f, lval* x) {
+    lval* s = lval_sexpr();
+    lval_add(s, lval_copy(f));
+    lval_add(s, x);
+    return lval_apply(e, s);
+}
+
+/* (amap f a) is a new array of f applied to each element of a */
+lval* builtin_amap(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("amap", argc, 2);
+    LASSERT_TYPE("amap", args, 0, LVAL_FUN);
+    LASSERT_TYPE("amap", args, 1, LVAL_ARRAY);
+
+    lval* a = args[1];
+    int n = a->count;
+    lval* r = lval_array(LVAL_NUM, n);
+
+    for (int i = 0; i < n; i++) {
+        lval* y = lval_call1(e, args[0], lval_aref(a, i));
+        int t = lval_type(y);
+        if (t != LVAL_NUM && t != LVAL_DBL) {
+            lval_del(r);
+            if (t == LVAL_ERR) { return y; }
+            lval_del(y);
+            return lval_err("Function 'amap' got %s from the function, Expected %s.",
+                ltype_name(t), ltype_name(LVAL_NUM));
+        }
+
+        /* The first float turns the results so far into doubles */
+        if (t == LVAL_DBL && r->kind == LVAL_NUM) {
+            double* d = malloc(sizeof(double) * n);
+            for (int j = 0; j < i; j++) { d[j] = r->ints[j]; }
+            free(r->ints);
+            r->dbls = d;
+            r->kind = LVAL_DBL;
+        }
+        if (r->kind == LVAL_DBL) { r->dbls[i] = lval_double(y); }
+        else { r->ints[i] = lval_number(y); }
+        lval_del(y);
+    }
+    return r;
+}
+
+/* (afilter f a) is a new array of the elements of a for which f is true */
+lval* builtin_afilter(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("afilter", argc, 2);
+    LASSERT_TYPE("afilter", args, 0, LVAL_FUN);
+    LASSERT_TYPE("afilter", args, 1, LVAL_ARRAY);
+
+    lval* a = args[1];
+    lval* r = lval_array(a->kind, a->count);
+    int n = 0;
+
+    for (int i = 0; i < a->count; i++) {
+        lval* y = lval_call1(e, args[0], lval_aref(a, i));
+        if (lval_type(y) == LVAL_ERR) { lval_del(r); return y; }
+        if (lval_truth(y)) {
+            if (a->kind == LVAL_DBL) { r->dbls[n++] = a->dbls[i]; }
+            else { r->ints[n++] = a->ints[i]; }
         }
-        
         lval_del(y);
     }
-    
-    lval_del(a);
-    return x;
+    r->count = r->cap = n;
+    return r;
+}
+
+/* Arithmetic and comparison. Each operator has its own builtin so the  */
+/* operation is chosen once per call rather than once per operand. Two */
+/* fixnums, by far the most common case, go straight to the machine    */
+/* operation; anything else takes the checked n-ary loop. Integers and */
+/* floats mix freely: if any operand is a float the whole operation is */
+/* done in double precision, otherwise it stays in integers, going to  */
+/* bignums as needed. The sum or difference of two fixnums always fits */
+/* a long; their product is checked.                                   */
+
+#define LVAL_FIX2(args, argc) \
+    (argc == 2 && lval_is_fixnum(args[0]) && lval_is_fixnum(args[1]))
+
+#define LASSERT_NUMS(func, args, argc) \
+    for (int i = 0; i < argc; i++) { \
+        int t = lval_type(args[i]); \
+        if (t != LVAL_DBL && t != LVAL_BIG) { LASSERT_TYPE(func, args, i, LVAL_NUM); } \
+    }
+
+int lval_any_dbl(lval** args, int argc) {
+    for (int i = 0; i < argc; i++) {
+        if (lval_type(args[i]) == LVAL_DBL) { return 1; }
+    }
+    return 0;
 }
 
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    int r;
+lval* builtin_add(lenv* e, lval** args, int argc) {
+    if (LVAL_FIX2(args, argc)) { return lval_num(lval_number(args[0]) + lval_number(args[1])); }
+    if (lval_any_array(args, argc)) { return lval_array_fold('+', args, argc); }
+    LASSERT_NUMS("+", args, argc);
 
-    if (strcmp(op, "eq") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
-    } else if (strcmp(op, "neq") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
+    if (lval_any_dbl(args, argc)) {
+        double x = lval_double(args[0]);
+        for (int i = 1; i < argc; i++) { x += lval_double(args[i]); }
+        return lval_dbl(x);
     }
 
-    lval_del(a);
-    return lval_num(r);
+    return lval_int_fold('+', args, argc);
 }
 
-lval* builtin_eq(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "eq");
-}
+lval* builtin_sub(lenv* e, lval** args, int argc) {
+    if (LVAL_FIX2(args, argc)) { return lval_num(lval_number(args[0]) - lval_number(args[1])); }
+    LASSERT_NUMS("-", args, argc);
 
-lval* builtin_ne(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "neq");
+    if (lval_any_dbl(args, argc)) {
+        double x = lval_double(args[0]);
+        if (argc == 1) { return lval_dbl(-x); }
+        for (int i = 1; i < argc; i++) { x -= lval_double(args[i]); }
+        return lval_dbl(x);
+    }
+
+    return lval_int_fold('-', args, argc);
 }
 
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
+lval* builtin_mul(lenv* e, lval** args, int argc) {
+    long r;
+    if (LVAL_FIX2(args, argc) && !lchk_long_mul(lval_number(args[0]), lval_number(args[1]), &r)) {
+        return lval_num(r);
+    }
+    if (lval_any_array(args, argc)) { return lval_array_fold('*', args, argc); }
+    LASSERT_NUMS("*", args, argc);
 
-    int r;
-    if (strcmp(op, ">") == 0) {
-        r = a->cell[0]->num > a->cell[1]->num;
-    } else if (strcmp(op, "<") == 0) {
-        r = a->cell[0]->num < a->cell[1]->num;
-    } else if (strcmp(op, ">=") == 0) {
-        r = a->cell[0]->num >= a->cell[1]->num;
-    } else if (strcmp(op, "<=") == 0) {
-        r = a->cell[0]->num <= a->cell[1]->num;
-    //} else if (strcmp(op, "==") == 0) {
-    //    r = a->cell[0]->num == a->cell[1]->num;
+    if (lval_any_dbl(args, argc)) {
+        double x = lval_double(args[0]);
+        for (int i = 1; i < argc; i++) { x *= lval_double(args[i]); }
+        return lval_dbl(x);
     }
 
-    lval_del(a);
-    return lval_num(r);
+    return lval_int_fold('*', args, argc);
 }
 
-//lval* builtin_eq(lenv* e, lval* a) {
-//    return builtin_ord(e, a, "==");
-//}
+lval* builtin_div(lenv* e, lval** args, int argc) {
+    LASSERT_NUMS("/", args, argc);
+
+    if (lval_any_dbl(args, argc)) {
+        double x = lval_double(args[0]);
+        for (int i = 1; i < argc; i++) {
+            double y = lval_double(args[i]);
+            if (y == 0) { return lval_err("Division By Zero."); }
+            x /= y;
+        }
+        return lval_dbl(x);
+    }
 
-lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
+    return lval_int_fold('/', args, argc);
 }
 
-lval* builtin_lt(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<");
+lval* builtin_eq(lenv* e, lval** args, int argc) {
+    if (LVAL_FIX2(args, argc)) { return lval_num(args[0] == args[1]); }
+    LASSERT_NUM("eq", argc, 2);
+    return lval_num(lval_eq(args[0], args[1]));
 }
 
-lval* builtin_ge(lenv* e, lval* a) {
-  return builtin_ord(e, a, ">=");
+lval* builtin_ne(lenv* e, lval** args, int argc) {
+    if (LVAL_FIX2(args, argc)) { return lval_num(args[0] != args[1]); }
+    LASSERT_NUM("neq", argc, 2);
+    return lval_num(!lval_eq(args[0], args[1]));
 }
 
-lval* builtin_le(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<=");
+/* Orderings take exactly two numbers */
+#define LVAL_ORD(name, op) \
+    lval* builtin_##name(lenv* e, lval** args, int argc) { \
+        if (LVAL_FIX2(args, argc)) { return lval_num(lval_number(args[0]) op lval_number(args[1])); } \
+        LASSERT_NUM(#op, argc, 2); \
+        LASSERT_NUMS(#op, args, argc); \
+        if (lval_any_dbl(args, argc)) { return lval_num(lval_double(args[0]) op lval_double(args[1])); } \
+        return lval_num(lval_cmp_int(args[0], args[1]) op 0); \
+    }
+
+LVAL_ORD(gt, >)
+LVAL_ORD(lt, <)
+LVAL_ORD(ge, >=)
+LVAL_ORD(le, <=)
+
+lval* builtin_int(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("integer?", argc, 1);
+    if (lval_type(args[0]) == LVAL_NUM || lval_type(args[0]) == LVAL_BIG) {
+        return lval_num(1);
+    } else {
+        return lval_num(0);
+    }
 }
 
-lval* builtin_int(lenv* e, lval* a) {
-    LASSERT_NUM("integer?", a, 1);
-    if (a->cell[0]->type == LVAL_NUM) {
+lval* builtin_float(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("float?", argc, 1);
+    if (lval_type(args[0]) == LVAL_DBL) {
         return lval_num(1);
     } else {
         return lval_num(0);
     }
 }
 
-lval* builtin_qexpr(lenv* e, lval* a) {
-    LASSERT_NUM("qexpr?", a, 1);
-    if (a->cell[0]->type == LVAL_QEXPR) {
+lval* builtin_qexpr(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("qexpr?", argc, 1);
+    if (lval_type(args[0]) == LVAL_QEXPR) {
         return lval_num(1);
     } else {
         return lval_num(0);
     }
 }
 
-lval* builtin_str(lenv* e, lval* a) {
-    LASSERT_NUM("string?", a, 1);
-    if (a->cell[0]->type == LVAL_STR) {
+lval* builtin_str(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("string?", argc, 1);
+    if (lval_type(args[0]) == LVAL_STR) {
         return lval_num(1);
     } else {
         return lval_num(0);
     }
 }
 
-lval* builtin_if(lenv* e, lval* a) {
+/* Conditions hold for any number but 0 or 0.0. A bignum is never 0. */
+bool lval_truth(lval* x) {
+    switch (lval_type(x)) {
+        case LVAL_NUM: return lval_number(x) != 0;
+        case LVAL_DBL: return lval_double(x) != 0;
+        case LVAL_BIG: return true;
+        default: return false;
+    }
+}
+
+/* Picks the clause of 'if' to take. On success returns NULL and points */
+/* branch into args, or at NULL when no clause matched.                 */
+lval* lval_if(lenv* e, lval** args, int argc, lval** branch) {
 
-    for (int i=0; i < a->count; i++) {
-        LASSERT_TYPE("if", a, i, LVAL_QEXPR);
+    for (int i=0; i < argc; i++) {
+        LASSERT_TYPE("if", args, i, LVAL_QEXPR);
         
-        if (i != a->count - 1) {
-            LASSERT(a, (a->cell[i]->cell[0]->type == LVAL_NUM || 
-                a->cell[i]->cell[0]->type == LVAL_SEXPR),
+        if (i != argc - 1) {
+            LASSERT((lval_type(args[i]->cell[0]) == LVAL_NUM || 
+                lval_type(args[i]->cell[0]) == LVAL_SEXPR),
             "Function 'if' condition passed incorrect type. Got %s, expected %s or %s.",
-            ltype_name(a->cell[i]->cell[0]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_SEXPR));
+            ltype_name(lval_type(args[i]->cell[0])), ltype_name(LVAL_NUM), ltype_name(LVAL_SEXPR));
             
         } else {
-            LASSERT(a, (a->cell[i]->cell[0]->type == LVAL_NUM || 
-                (a->cell[i]->cell[0]->type == LVAL_SYM && strcmp(a->cell[i]->cell[0]->sym, "else") == 0) ||
-                a->cell[i]->cell[0]->type == LVAL_SEXPR),
+            LASSERT((lval_type(args[i]->cell[0]) == LVAL_NUM || 
+                (lval_type(args[i]->cell[0]) == LVAL_SYM && strcmp(args[i]->cell[0]->sym, "else") == 0) ||
+                lval_type(args[i]->cell[0]) == LVAL_SEXPR),
             "Function 'if' condition passed incorrect type. Got %s, expected %s, %s or 'else'.",
-            ltype_name(a->cell[i]->cell[0]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_SEXPR));
+            ltype_name(lval_type(args[i]->cell[0])), ltype_name(LVAL_NUM), ltype_name(LVAL_SEXPR));
         }
     }
 
-    lval* x = NULL;
+    *branch = NULL;
 
-    for (int i=0; i < a->count - 1; i++) {
-        a->cell[i]->cell[0] = lval_eval(e, a->cell[i]->cell[0]);
-        if (a->cell[i]->cell[0]->num) {
-            x = lval_eval(e, lval_pop(a->cell[i], 1));
-            break;
-        }
-    }
+    for (int i=0; i < argc; i++) {
+        lval* cond = args[i]->cell[0];
 
-    if (!x && a->cell[a->count - 1]->cell[0]->type == LVAL_SYM && strcmp(a->cell[a->count - 1]->cell[0]->sym, "else") == 0) {
-        x = lval_eval(e, lval_pop(a->cell[a->count - 1], 1));
-    } else if (!x && a->cell[a->count - 1]->cell[0]->num) {
-        if (a->cell[a->count - 1]->count > 1) {
-            lval_print(a->cell[a->count - 1]->cell[2]);
+        /* Only the last clause may be 'else', which always matches */
+        if (lval_type(cond) != LVAL_SYM) {
+            cond = lval_eval_code(e, cond);
+            bool taken = lval_truth(cond);
+            lval_del(cond);
+            if (!taken) { continue; }
         }
-        x = lval_eval(e, lval_pop(a->cell[a->count - 1], 1)); 
-    } else if (!x) {
-        x = lval_sexpr();
+
+        *branch = args[i]->cell[1];
+        break;
     }
 
-    lval_del(a);
-    return x;
+    return NULL;
+}
+
+lval* builtin_if(lenv* e, lval** args, int argc) {
+    lval* branch;
+    lval* err = lval_if(e, args, argc, &branch);
+    if (err) { return err; }
+
+    return branch ? lval_eval_code(e, branch) : lval_sexpr();
 }
 
-lval* builtin_and(lenv* e, lval* a) {
-    for (int i=0; i < a->count; i++) {
-        LASSERT_TYPE("and", a, i, LVAL_NUM);
+lval* builtin_and(lenv* e, lval** args, int argc) {
+    for (int i=0; i < argc; i++) {
+        LASSERT_TYPE("and", args, i, LVAL_NUM);
     }
 
-    for (int i=0; i < a->count; i++) {
-        if (a->cell[i]->num == 0) {
-            lval_del(a);
+    for (int i=0; i < argc; i++) {
+        if (lval_number(args[i]) == 0) {
             return lval_num(0);
         }
     }
     
-    lval_del(a);
     return lval_num(1);
 }
 
-lval* builtin_or(lenv* e, lval* a) {
-    for (int i=0; i < a->count; i++) {
-        LASSERT_TYPE("or", a, i, LVAL_NUM);
+lval* builtin_or(lenv* e, lval** args, int argc) {
+    for (int i=0; i < argc; i++) {
+        LASSERT_TYPE("or", args, i, LVAL_NUM);
     }
 
-    for (int i=0; i < a->count; i++) {
-        if (a->cell[i]->num == 1) {
-            lval_del(a);
+    for (int i=0; i < argc; i++) {
+        if (lval_number(args[i]) == 1) {
             return lval_num(1);
         }
     }
     
-    lval_del(a);
     return lval_num(0);
 }
 
-lval* builtin_not(lenv* e, lval* a) {
-    LASSERT_NUM("not", a, 1);
-    LASSERT_TYPE("not", a, 0, LVAL_NUM);
+lval* builtin_not(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("not", argc, 1);
+    LASSERT_TYPE("not", args, 0, LVAL_NUM);
 
-    if (a->cell[0]->num == 0) {
+    if (lval_number(args[0]) == 0) {
         return lval_num(1);
     } else {
         return lval_num(0);
     }
 }
 
-lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
-}
-
-lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
-}
-
-lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
-}
-
-lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
-}
-
-lval* builtin_var(lenv* e, lval* a, char* func) {
-    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+lval* builtin_var(lenv* e, lval** args, int argc, char* func) {
+    LASSERT_TYPE(func, args, 0, LVAL_QEXPR);
 
-    lval* syms = a->cell[0];
+    lval* syms = args[0];
 
     for (int i=0; i < syms->count; i++) {
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+        LASSERT((lval_type(syms->cell[i]) == LVAL_SYM),
         "Function '%s' cannot define non-symbol. "
         "Got %s, Expected %s.", func,
-        ltype_name(syms->cell[i]->type),
+        ltype_name(lval_type(syms->cell[i])),
         ltype_name(LVAL_SYM));
     }
 
-    LASSERT(a, (syms->count == a->count-1),
+    LASSERT((syms->count == argc-1),
     "Function '%s' passed too many arguments for symbols. \
-    Got %i, Expected %i.", func, syms->count, a->count-1);
+    Got %i, Expected %i.", func, syms->count, argc-1);
 
     for (int i=0; i < syms->count; i++) {
         if (strcmp(func, "def") == 0) {
-            lenv_def(e, syms->cell[i], a->cell[i + 1]);
+            lenv_def(e, syms->cell[i], args[i + 1]);
         }
 
         if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i + 1]);
+            lenv_put(e, syms->cell[i], args[i + 1]);
         }
     }
     
-    lval_del(a);
     return lval_sexpr(); 
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
+lval* builtin_def(lenv* e, lval** args, int argc) {
+    return builtin_var(e, args, argc, "def");
 }
 
-lval *builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+lval *builtin_put(lenv* e, lval** args, int argc) {
+    return builtin_var(e, args, argc, "=");
 }
 
-lval *builtin_empty(lenv* e, lval* a) {
-    LASSERT_NUM("empty?", a, 1);
-    LASSERT_TYPE("empty?", a, 0, LVAL_QEXPR);
-    if (a->cell[0]->count == 0) {
+lval *builtin_empty(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("empty?", argc, 1);
+    LASSERT_TYPE("empty?", args, 0, LVAL_QEXPR);
+    if (args[0]->count == 0) {
         return lval_num(1);
     } else {
         return lval_num(0);
     }
 }
 
-lval* builtin_cons(lenv* e, lval* a){
+lval* builtin_cons(lenv* e, lval** args, int argc){
 
-    LASSERT_NUM("cons", a, 2);
-    LASSERT_TYPE("cons", a, 1, LVAL_QEXPR);
+    LASSERT_NUM("cons", argc, 2);
+    LASSERT_TYPE("cons", args, 1, LVAL_QEXPR);
 
-    a->type = LVAL_QEXPR;
-    if (a->cell[1]->type == LVAL_QEXPR && a->cell[1]->count == 0) {
-        lval_pop(a, 1);
-        return a;
-    } else {
-        lval* second = lval_pop(a, 1);
-        return lval_join(a, second);
-    }
+    return lval_cons(args[0], args[1]);
 }
 
 lval* lval_read(mpc_ast_t* t);
 
-lval* builtin_load(lenv* e, lval* a) {
-    LASSERT_NUM("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
+lval* builtin_load(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("load", argc, 1);
+    LASSERT_TYPE("load", args, 0, LVAL_STR);
 
     mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
+    char* path = lval_cstr(args[0]);
+    bool parsed = mpc_parse_contents(path, Lispy, &r);
+    free(path);
+
+    if (parsed) {
         lval* expr = lval_read(r.output);
         mpc_ast_delete(r.output);
 
+        /* Remaining expressions must survive collections between forms */
+        gc_root(args[0]);
+        gc_root(expr);
+
         while(expr->count) {
+            gc_enter();
             lval* x = lval_eval(e, lval_pop(expr, 0));
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+            gc_leave();
         }
 
+        gc_unroot();
+        gc_unroot();
+
         lval_del(expr);
-        lval_del(a);
 
         return lval_sexpr();
 
@@ -897,100 +2947,225 @@ lval* builtin_load(lenv* e, lval* a) {
 
         lval* err = lval_err("Could not load Library %s", err_msg);
         free(err_msg);
-        lval_del(a);
 
         return err;
     }
 }
 
-lval* builtin_print(lenv* e, lval* a) {
+lval* builtin_print(lenv* e, lval** args, int argc) {
 
   /* Print each argument followed by a space */
-  for (int i = 0; i < a->count; i++) {
-    lval_print(a->cell[i]); putchar(' ');
+  for (int i = 0; i < argc; i++) {
+    lval_print(args[i]); putchar(' ');
   }
 
-  /* Print a newline and delete arguments */
+  /* Print a newline */
   putchar('\n');
-  lval_del(a);
 
   return lval_sexpr();
 }
 
-lval* builtin_error(lenv* e, lval* a) {
-  LASSERT_NUM("error", a, 1);
-  LASSERT_TYPE("error", a, 0, LVAL_STR);
+lval* builtin_error(lenv* e, lval** args, int argc) {
+  LASSERT_NUM("error", argc, 1);
+  LASSERT_TYPE("error", args, 0, LVAL_STR);
 
   /* Construct Error from first argument */
-  lval* err = lval_err(a->cell[0]->str);
+  return lval_err("%.*s", args[0]->count, args[0]->str);
+}
+
+/* Strings are handled as bytes. Each of these takes time in proportion */
+/* to the bytes it reads or writes, at most.                            */
+
+#define LASSERT_STRS(func, args, from, argc) \
+    for (int i = from; i < argc; i++) { LASSERT_TYPE(func, args, i, LVAL_STR); }
+
+lval* builtin_str_concat(lenv* e, lval** args, int argc) {
+    LASSERT_STRS("str-concat", args, 0, argc);
+    if (argc == 0) { return lval_str(""); }
+
+    return lval_str_append(args[0], args + 1, argc - 1);
+}
+
+lval* builtin_str_len(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("str-len", argc, 1);
+    LASSERT_TYPE("str-len", args, 0, LVAL_STR);
+
+    return lval_num(args[0]->count);
+}
+
+/* (substr s start n) is the n bytes of s from start, as far as s goes */
+lval* builtin_substr(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("substr", argc, 3);
+    LASSERT_TYPE("substr", args, 0, LVAL_STR);
+    LASSERT_TYPE("substr", args, 1, LVAL_NUM);
+    LASSERT_TYPE("substr", args, 2, LVAL_NUM);
+
+    long len = args[0]->count;
+    long start = lval_number(args[1]);
+    long n = lval_number(args[2]);
+    if (start < 0) { start = 0; }
+    if (start > len) { start = len; }
+    if (n < 0) { n = 0; }
+    if (n > len - start) { n = len - start; }
+    return lval_substr(args[0], start, n);
+}
+
+/* The offset of the first n bytes at t within the m bytes at s, or -1. */
+/* Knuth-Morris-Pratt, so linear in m + n whatever the bytes are.       */
+long lval_str_find(char* s, long m, char* t, long n) {
+    if (n == 0) { return 0; }
+    if (n == 1) {
+        char* p = memchr(s, t[0], m);
+        return p ? p - s : -1;
+    }
+
+    /* fail[i] is the length of the longest proper border of t[0..i] */
+    long* fail = malloc(sizeof(long) * n);
+    fail[0] = 0;
+    for (long i = 1, k = 0; i < n; i++) {
+        while (k > 0 && t[i] != t[k]) { k = fail[k - 1]; }
+        if (t[i] == t[k]) { k++; }
+        fail[i] = k;
+    }
+
+    long r = -1;
+    for (long i = 0, k = 0; i < m; i++) {
+        while (k > 0 && s[i] != t[k]) { k = fail[k - 1]; }
+        if (s[i] == t[k]) { k++; }
+        if (k == n) { r = i - n + 1; break; }
+    }
+    free(fail);
+    return r;
+}
+
+/* (index-of s t) is where t first occurs in s, or -1 */
+lval* builtin_index_of(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("index-of", argc, 2);
+    LASSERT_STRS("index-of", args, 0, argc);
+
+    return lval_num(lval_str_find(args[0]->str, args[0]->count, args[1]->str, args[1]->count));
+}
+
+/* (split s sep) is the list of the pieces of s between occurrences of sep */
+lval* builtin_split(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("split", argc, 2);
+    LASSERT_STRS("split", args, 0, argc);
+    LASSERT(args[1]->count > 0, "Function 'split' passed an empty separator.");
+
+    lval* s = args[0];
+    lval* sep = args[1];
+    lval* x = lval_qexpr();
+
+    long start = 0;
+    for (;;) {
+        long i = lval_str_find(s->str + start, s->count - start, sep->str, sep->count);
+        if (i < 0) { break; }
+        lval_add(x, lval_substr(s, start, i));
+        start += i + sep->count;
+    }
+    return lval_add(x, lval_substr(s, start, s->count - start));
+}
+
+/* (str-join {strings} sep) is the strings in one, with sep between each */
+lval* builtin_str_join(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("str-join", argc, 2);
+    LASSERT_TYPE("str-join", args, 0, LVAL_QEXPR);
+    LASSERT_TYPE("str-join", args, 1, LVAL_STR);
+
+    lval* l = args[0];
+    lval* sep = args[1];
+    long n = 0;
+    for (int i = 0; i < l->count; i++) {
+        LASSERT(lval_type(l->cell[i]) == LVAL_STR,
+            "Function 'str-join' passed incorrect type for element %i. Got %s, Expected %s.",
+            i, ltype_name(lval_type(l->cell[i])), ltype_name(LVAL_STR));
+        n += l->cell[i]->count + (i ? sep->count : 0);
+    }
 
-  /* Delete arguments and return */
-  lval_del(a);
-  return err;
+    lval* x = lval_strcap("", 0, n);
+    char* p = x->str;
+    for (int i = 0; i < l->count; i++) {
+        if (i) {
+            memcpy(p, sep->str, sep->count);
+            p += sep->count;
+        }
+        memcpy(p, l->cell[i]->str, l->cell[i]->count);
+        p += l->cell[i]->count;
+    }
+    x->count = n;
+    lval_str_claim(x);
+    return x;
 }
 
-lval* builtin_zero(lenv* e, lval* a) {
-    LASSERT_NUM("zero?", a, 1);
-    LASSERT_TYPE("zero?", a, 0, LVAL_NUM);
+lval* builtin_zero(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("zero?", argc, 1);
+    LASSERT_TYPE("zero?", args, 0, LVAL_NUM);
 
-    return builtin_not(e, a);
+    return builtin_not(e, args, argc);
 }
 
-lval* builtin_length(lenv* e, lval* a) {
-    LASSERT_NUM("length", a, 1);
-    LASSERT_TYPE("length", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("length", a, 0);
+lval* builtin_length(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("length", argc, 1);
+    if (lval_type(args[0]) == LVAL_ARRAY) { return lval_num(args[0]->count); }
+    LASSERT_TYPE("length", args, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("length", args, 0);
     
-    return lval_num(a->cell[0]->count);
+    return lval_num(args[0]->count);
 }
 
-lval* builtin_get(lenv*e, lval* a) {
-    LASSERT_NUM("get", a, 1);
-    LASSERT_TYPE("get", a, 0, LVAL_QEXPR);
-    LASSERT_NUM("get", a->cell[0], 2);
+lval* builtin_get(lenv*e, lval** args, int argc) {
+    LASSERT_NUM("get", argc, 1);
+    LASSERT_TYPE("get", args, 0, LVAL_QEXPR);
+    LASSERT_NUM("get", args[0]->count, 2);
 
-    lval* inst = lenv_get(e, a->cell[0]->cell[0]);
+    lval* inst = lenv_get(e, args[0]->cell[0]);
     lval* struc = lenv_get(e, inst);
 
+    lval* r = NULL;
     for (int i=0; i < struc->fields->count; i++) {
-        if (strcmp(struc->fields->cell[i]->sym, a->cell[0]->cell[1]->sym) == 0) {
-            return inst->fields->cell[i];
+        if (struc->fields->cell[i]->sym == args[0]->cell[1]->sym) {
+            r = lval_copy(inst->fields->cell[i]);
+            break;
         }
     }
-    return lval_err("Struct '%s' has no attribute '%s'.", inst->struc, a->cell[0]->cell[1]->sym);
+    if (!r) { r = lval_err("Struct '%s' has no attribute '%s'.", inst->struc, args[0]->cell[1]->sym); }
+
+    lval_del(struc);
+    lval_del(inst);
+    return r;
 }
 
-lval* builtin_make(lenv* e, lval* a) {
-    LASSERT_NUM("make", a, 2);
-    LASSERT_TYPE("make", a, 0, LVAL_SYM);
-    LASSERT_TYPE("make", a, 1, LVAL_QEXPR);
+lval* builtin_make(lenv* e, lval** args, int argc) {
+    LASSERT_NUM("make", argc, 2);
+    LASSERT_TYPE("make", args, 0, LVAL_SYM);
+    LASSERT_TYPE("make", args, 1, LVAL_QEXPR);
 
-    lval* struc = lenv_get(e, a->cell[0]);
+    lval* struc = lenv_get(e, args[0]);
+    int nfields = struc->fields->count;
+    lval_del(struc);
 
-    LASSERT(a, (a->cell[1]->count - 1 == struc->fields->count),
+    LASSERT((args[1]->count - 1 == nfields),
     "Struct '%s' passed incorrect number of arguments. \
-     Got %i, Expected %i.", a->cell[0], a->count-1, struc->fields->count);
+     Got %i, Expected %i.", args[0]->sym, argc-1, nfields);
 
-    lval* name = lval_pop(a->cell[1], 0);
     lval* inst = lval_instance();
-    inst->struc = a->cell[0]->sym;
-    inst->fields = a->cell[1];
-    lenv_put(e, name, inst);
+    inst->struc = args[0]->sym;
+    inst->fields = lval_list(args[1]->cell + 1, args[1]->count - 1);
+    lenv_put(e, args[1]->cell[0], inst);
+    lval_del(inst);
 
     return lval_num(0);
 }
 
-lval* builtin_struct(lenv* e, lval* a) {
+lval* builtin_struct(lenv* e, lval** args, int argc) {
     lval* struc = lval_struct();
-    lval* body = lval_pop(a, 0);
-    lval* name = lval_pop(body, 0);
+    struc->fields = lval_list(args[0]->cell + 1, args[0]->count - 1);
+    lenv_put(e, args[0]->cell[0], struc);
+    lval_del(struc);
 
-    struc->fields = body;
-    lenv_put(e, name, struc);
-
-    //char* make = malloc(strlen(a->cell[0]->cell[0]->sym) + 6);
+    //char* make = malloc(strlen(args[0]->cell[0]->sym) + 6);
     //strcpy(make, "make-"); 
-    //strcat(make, a->cell[0]->cell[0]->sym);
+    //strcat(make, args[0]->cell[0]->sym);
     //free(make);
 
     return lval_num(0);
@@ -1015,6 +3190,7 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "length", builtin_length);
     lenv_add_builtin(e, "string?", builtin_str);
     lenv_add_builtin(e, "integer?", builtin_int);
+    lenv_add_builtin(e, "float?", builtin_float);
     lenv_add_builtin(e, "qexpr?", builtin_qexpr);
     lenv_put(e, sym, empty);
     lenv_add_builtin(e, "zero?", builtin_zero);
@@ -1027,6 +3203,8 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "list", builtin_list);
     lenv_add_builtin(e, "first", builtin_first);
     lenv_add_builtin(e, "rest", builtin_rest);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "join", builtin_join);
     lenv_add_builtin(e, "lambda", builtin_lambda);
@@ -1037,6 +3215,15 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "*", builtin_mul);
     lenv_add_builtin(e, "/", builtin_div);
 
+    /* Array Functions */
+    lenv_add_builtin(e, "array", builtin_array);
+    lenv_add_builtin(e, "aref", builtin_aref);
+    lenv_add_builtin(e, "aset", builtin_aset);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "dot", builtin_dot);
+    lenv_add_builtin(e, "amap", builtin_amap);
+    lenv_add_builtin(e, "afilter", builtin_afilter);
+
     /* Comparison Functions */
     lenv_add_builtin(e, "eq?", builtin_eq);
     lenv_add_builtin(e, "!=", builtin_ne);
@@ -1056,125 +3243,758 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "load",  builtin_load);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+    lenv_add_builtin(e, "str-concat", builtin_str_concat);
+    lenv_add_builtin(e, "str-len", builtin_str_len);
+    lenv_add_builtin(e, "substr", builtin_substr);
+    lenv_add_builtin(e, "index-of", builtin_index_of);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "str-join", builtin_str_join);
 
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    if (f->builtin) { return f->builtin(e, a); }
+lval* lcode_run(lenv* e, lval* f, bool own);
+
+/* A partial application shares the lambda's code and keeps the bound */
+/* arguments in its cells.                                             */
+lval* lval_partial(lval* f, lval** args, int argc) {
+    lval* p = lval_new(LVAL_FUN);
+    p->builtin = NULL;
+    p->count = p->cap = f->count + argc;
+    p->cell = malloc(sizeof(lval*) * p->count);
+    for (int i = 0; i < f->count; i++) {
+        p->cell[i] = lval_copy(f->cell[i]);
+    }
+    for (int i = 0; i < argc; i++) {
+        p->cell[f->count + i] = lval_copy(args[i]);
+    }
+    p->formals = lval_copy(f->formals);
+    p->body = lval_copy(f->body);
+    p->code = f->code;
+    if (p->code) { p->code->rc++; }
+
+    return p;
+}
+
+/* Lambdas are never modified by a call. Each call binds its arguments  */
+/* into a new frame, after any a partial application has already bound. */
+/* Returns the frame once every formal is bound, otherwise NULL with an */
+/* error or a new partial application in r. v is the evaluated call,   */
+/* whose tail a '&' formal takes as a slice rather than a copy.         */
+lenv* lval_frame(lenv* e, lval* v, lval** r) {
+    lval* f = v->cell[0];
+    lval** args = v->cell + 1;
+    int argc = v->count - 1;
+    lval* formals = f->formals;
+
+    /* Short of arguments, and no '&' among the formals they reach */
+    int n = f->count + argc;
+    if (n < formals->count) {
+        int j = f->count;
+        while (j <= n && formals->cell[j]->sym != lsym_amp) { j++; }
+        if (j > n) {
+            *r = lval_partial(f, args, argc);
+            return NULL;
+        }
+    }
+
+    lenv* frame = lenv_new();
+    frame->parent = e;
 
-    int given = a->count;
-    int total = f->formals->count;
+    for (int i = 0; i < f->count; i++) {
+        lenv_put(frame, formals->cell[i], f->cell[i]);
+    }
+
+    int given = argc;
+    int total = formals->count - f->count;
+    int i = f->count;
+    int k = 0;
 
-    while (a->count) {
-        if (f->formals->count == 0) {
-            lval_del(a);
-            return lval_err("Function passed too many arguments. Got %i, expected %i.", given, total);
+    for (; k < argc; k++, i++) {
+        if (i == formals->count) {
+            *r = lval_err("Function passed too many arguments. Got %i, expected %i.", given, total);
+            goto fail;
         }
 
-        lval* sym = lval_pop(f->formals, 0);
+        lval* sym = formals->cell[i];
 
-        if (strcmp(sym->sym, "&") == 0) {
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function invalid format. Symbol '&' not followed by single symbol.");
+        if (sym->sym == lsym_amp) {
+            if (formals->count - i != 2) {
+                *r = lval_err("Function invalid format. Symbol '&' not followed by single symbol.");
+                goto fail;
             }
 
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym);
-            lval_del(nsym);
+            lval* rest = lval_slice(v, 1 + k, argc - k);
+            lenv_put(frame, formals->cell[i + 1], rest);
+            lval_del(rest);
+            i = formals->count;
             break;
         }
 
-        lval* val = lval_pop(a, 0);
-        lenv_put(f->env, sym, val);
-
-        lval_del(sym);
-        lval_del(val);
+        lenv_put(frame, sym, args[k]);
     }
 
-    lval_del(a);
-
-    if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
-        if (f->formals->count != 2) {
-            return lval_err("Function format invalid. Symbol '&' not followed by a single symbol.");
+    if (i < formals->count && formals->cell[i]->sym == lsym_amp) {
+        if (formals->count - i != 2) {
+            *r = lval_err("Function format invalid. Symbol '&' not followed by a single symbol.");
+            goto fail;
         }
-    
-        lval_del(lval_pop(f->formals, 0));
-        lval* sym = lval_pop(f->formals, 0);
-        lval* val = lval_qexpr();
 
-        lenv_put(f->env, sym, val);
-        lval_del(sym);
+        lval* val = lval_qexpr();
+        lenv_put(frame, formals->cell[i + 1], val);
         lval_del(val);
+        i = formals->count;
     }
 
-    if (f->formals->count == 0) {
-        f->env->parent = e;
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        return lval_copy(f);
-    }
+    return frame;
+
+fail:
+    lenv_del(frame);
+    return NULL;
+}
+
+lval* lval_call(lenv* e, lval* v) {
+    lval* f = v->cell[0];
+    if (f->builtin) { return f->builtin(e, v->cell + 1, v->count - 1); }
+
+    lval* r;
+    lenv* frame = lval_frame(e, v, &r);
+    if (!frame) { return r; }
+
+    r = f->code ? lcode_run(frame, f, false) : lval_eval_sexpr(frame, f->body);
+    lenv_del(frame);
+    return r;
 }
 
 /* Evaluation */
 
+/* Code is never modified while it runs: the evaluators below borrow the */
+/* expression and build fresh values, so a lambda body is shared by all  */
+/* of its calls instead of being copied into each one.                   */
+
+/* True when the evaluated S-expression x is a call the loop below can */
+/* make itself, a lambda or 'if' with no error among its arguments      */
+bool lval_tail(lval* x) {
+    if (x->count < 2 || lval_type(x->cell[0]) != LVAL_FUN) { return false; }
+    if (x->cell[0]->builtin && x->cell[0]->builtin != builtin_if) { return false; }
+
+    for (int i = 1; i < x->count; i++) {
+        if (lval_type(x->cell[i]) == LVAL_ERR) { return false; }
+    }
+    return true;
+}
+
+/* Evaluates the elements of v as an S-expression, v may be a Q-expression. */
+/*                                                                          */
+/* Calls in tail position do not recurse. The body of a lambda, or the      */
+/* branch 'if' picks, replaces the expression being evaluated and the loop  */
+/* goes round again. A lambda frame is released as soon as the frames after */
+/* it bind every name in it, as lookups can then never reach it, so a loop  */
+/* holds at most one frame per name instead of one per call. See           */
+/* lenv_prune.                                                              */
 lval* lval_eval_sexpr(lenv* e, lval* v) {
-    
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+    lval* code = lval_copy(v);
+    lenv* frame = NULL;
+    lenv** held = NULL;
+    int nheld = 0;
+    lval* r;
+
+    for (;;) {
+        lval* x = lval_sexpr();
+        lval_reserve(x, code->count);
+
+        for (int i = 0; i < code->count; i++) {
+            x->cell[i] = lval_eval_code(e, code->cell[i]);
+            x->count++;
+        }
+
+        if (!lval_tail(x)) {
+            r = lval_apply(e, x);
+            break;
+        }
+
+        lval* f = x->cell[0];
+        lval* next;
+
+        if (f->builtin) {
+            r = lval_if(e, x->cell + 1, x->count - 1, &next);
+            if (r) { lval_del(x); break; }
+
+            /* Only an S-expression branch is a call worth looping on */
+            if (!next || lval_type(next) != LVAL_SEXPR) {
+                r = next ? lval_eval_code(e, next) : lval_sexpr();
+                lval_del(x);
+                break;
+            }
+
+            next = lval_copy(next);
+            lval_del(x);
+            lval_del(code);
+            code = next;
+            continue;
+        }
+
+        lenv* callee = lval_frame(e, x, &r);
+        if (!callee) { lval_del(x); break; }
+
+        if (frame && lenv_shadows(callee, frame)) {
+            callee->parent = frame->parent;
+            lenv_del(frame);
+        } else if (frame) {
+            held = realloc(held, sizeof(lenv*) * (nheld + 1));
+            held[nheld++] = frame;
+        }
+        if (nheld) { nheld = lenv_prune(callee, held, nheld); }
+
+        frame = callee;
+        e = callee;
+
+        if (f->code) {
+            r = lcode_run(e, f, false);
+            lval_del(x);
+            break;
+        }
+
+        lval_del(code);
+        code = lval_copy(f->body);
+        lval_del(x);
     }
+
+    lval_del(code);
+    if (frame) { lenv_del(frame); }
+    while (nheld) { lenv_del(held[--nheld]); }
+    free(held);
+    return r;
+}
+
+/* Calls an S-expression whose elements have already been evaluated */
+lval* lval_apply(lenv* e, lval* v) {
     
     for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+        if (lval_type(v->cell[i]) == LVAL_ERR) { return lval_take(v, i); }
     }
     
     if (v->count == 0) { return v; }    
     if (v->count == 1) { return lval_take(v, 0); }
     
     /* Ensure first element is a function after evaluation */
-    lval* f = lval_pop(v, 0);
+    lval* f = v->cell[0];
 
-    if (f->type == LVAL_SYM) {
+    if (lval_type(f) == LVAL_SYM) {
             lval* x = lenv_get(e, f);
             lval_del(f);
-            f = x;
-            if (f->type == LVAL_ERR) { return f; }
+            f = v->cell[0] = x;
+            if (lval_type(f) == LVAL_ERR) { return lval_take(v, 0); }
         }
 
-    if (f->type != LVAL_FUN) {
+    if (lval_type(f) != LVAL_FUN) {
         lval* err = lval_err(
             "S-Expression starts with incorrect type. "
             "Got %s, Expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f);
+            ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
         lval_del(v);
         return err;
     }
     
-    /* If so call function to get result */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
+    /* If so call function on the rest of the elements, which it borrows */
+    lval* result = lval_call(e, v);
+    lval_del(v);
     return result;
 }   
 
+/* Evaluates v without consuming it */
+lval* lval_eval_code(lenv* e, lval* v) {
+
+    if (lval_type(v) == LVAL_SYM) {
+        /* Resolved symbols read their frame slot without a lookup */
+        int i = v->slot;
+        return (i >= 0 && i < e->count && e->syms[i] == v->sym)
+            ? lval_copy(e->vals[i]) : lenv_get(e, v);
+    }
+    if (lval_type(v) == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    return lval_copy(v);
+}
+
 lval* lval_eval(lenv* e, lval* v) {
+    lval* x = lval_eval_code(e, v);
+    lval_del(v);
+    return x;
+}
 
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
+/* Bytecode */
+
+/* Lambda bodies are compiled when the lambda is created into code for a  */
+/* stack machine. The tree-walker stays for top-level forms, 'eval' and   */
+/* any lambda when LVAL_VM is 0, and the compiled code is built to give   */
+/* exactly the same results:                                              */
+/*                                                                        */
+/*   OP_CONST k         push constant k (numbers, strings, Q-expressions) */
+/*   OP_LOCAL s k       push frame slot s, or look symbol k up by name    */
+/*   OP_LOOKUP k        look symbol k up by name                          */
+/*   OP_EMPTY           push ()                                           */
+/*   OP_IF l            pop the head if it is the 'if' builtin, else jump */
+/*                      to l where the clauses are passed to it as usual  */
+/*   OP_JUMP_FALSE l    pop, jump to l unless lval_truth holds for it     */
+/*   OP_JUMP l          jump to l                                         */
+/*   OP_CALL n          evaluate the top n values as an S-expression      */
+/*   OP_TAIL n          the same in tail position, without recursing      */
+/*   OP_RETURN          pop and return the result                         */
+/*                                                                        */
+/* Calls to compiled lambdas with plain formals and the right number of   */
+/* arguments get a fresh frame straight from the operand stack. Anything  */
+/* else goes through lval_apply, like the tree-walker.                    */
+
+/* Threaded dispatch jumps straight from one instruction to the next */
+#ifndef LVAL_VM_THREADED
+#ifdef __GNUC__
+#define LVAL_VM_THREADED 1
+#else
+#define LVAL_VM_THREADED 0
+#endif
+#endif
+
+enum { OP_CONST, OP_LOCAL, OP_LOOKUP, OP_EMPTY, OP_IF, OP_JUMP_FALSE,
+       OP_JUMP, OP_CALL, OP_TAIL, OP_RETURN };
+
+
+void lcode_emit(lcode* c, int op) {
+    c->count++;
+    c->ops = realloc(c->ops, sizeof(int) * c->count);
+    c->ops[c->count-1] = op;
+}
+
+int lcode_const(lcode* c, lval* x) {
+    c->nconsts++;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->nconsts);
+    c->consts[c->nconsts-1] = lval_copy(x);
+    return c->nconsts-1;
+}
+
+void lcode_push(lcode* c, int n) {
+    c->depth += n;
+    if (c->depth > c->max_stack) { c->max_stack = c->depth; }
+}
+
+/* A call to 'if' can be inlined when builtin_if would accept its clauses */
+bool lcode_inline_if(lval* x) {
+    if (x->count < 2 || lval_type(x->cell[0]) != LVAL_SYM
+        || strcmp(x->cell[0]->sym, "if") != 0) { return false; }
+
+    for (int i = 1; i < x->count; i++) {
+        lval* clause = x->cell[i];
+        if (lval_type(clause) != LVAL_QEXPR || clause->count < 2) { return false; }
+
+        int t = lval_type(clause->cell[0]);
+        bool last = i == x->count - 1;
+        if (t != LVAL_NUM && t != LVAL_SEXPR
+            && !(last && t == LVAL_SYM && strcmp(clause->cell[0]->sym, "else") == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void lcode_expr(lcode* c, lval* x, lval* formals, bool tail);
+
+void lcode_sexpr(lcode* c, lval* x, lval* formals, bool tail) {
+
+    /* () evaluates to itself and (x) to the value of x */
+    if (x->count == 0) { lcode_emit(c, OP_EMPTY); lcode_push(c, 1); return; }
+    if (x->count == 1) { lcode_expr(c, x->cell[0], formals, tail); return; }
+
+    if (lcode_inline_if(x)) {
+        lcode_expr(c, x->cell[0], formals, false);
+        lcode_emit(c, OP_IF);
+        int generic = c->count;
+        lcode_emit(c, 0);
+        lcode_push(c, -1);
+
+        int* ends = malloc(sizeof(int) * x->count);
+        int nends = 0;
+
+        for (int i = 1; i < x->count; i++) {
+            lval* clause = x->cell[i];
+            int skip = -1;
+
+            if (lval_type(clause->cell[0]) != LVAL_SYM) {
+                lcode_expr(c, clause->cell[0], formals, false);
+                lcode_emit(c, OP_JUMP_FALSE);
+                skip = c->count;
+                lcode_emit(c, 0);
+                lcode_push(c, -1);
+            }
+
+            lcode_expr(c, clause->cell[1], formals, tail);
+            lcode_push(c, -1);
+            lcode_emit(c, OP_JUMP);
+            ends[nends++] = c->count;
+            lcode_emit(c, 0);
+
+            if (skip < 0) { break; }
+            c->ops[skip] = c->count;
+        }
+
+        /* No clause matched */
+        lcode_emit(c, OP_EMPTY);
+        lcode_emit(c, OP_JUMP);
+        ends[nends++] = c->count;
+        lcode_emit(c, 0);
+
+        /* Something other than the builtin is bound to 'if' */
+        c->ops[generic] = c->count;
+        lcode_push(c, 1);
+        for (int i = 1; i < x->count; i++) {
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, x->cell[i]));
+            lcode_push(c, 1);
+        }
+        lcode_emit(c, tail ? OP_TAIL : OP_CALL);
+        lcode_emit(c, x->count);
+        lcode_push(c, 1 - x->count);
+
+        for (int i = 0; i < nends; i++) { c->ops[ends[i]] = c->count; }
+        free(ends);
+        return;
+    }
+
+    for (int i = 0; i < x->count; i++) {
+        lcode_expr(c, x->cell[i], formals, false);
+    }
+    lcode_emit(c, tail ? OP_TAIL : OP_CALL);
+    lcode_emit(c, x->count);
+    lcode_push(c, 1 - x->count);
+}
+
+void lcode_expr(lcode* c, lval* x, lval* formals, bool tail) {
+    switch (lval_type(x)) {
+        case LVAL_SYM: {
+            int slot = lval_slot(formals, x->sym);
+            if (slot >= 0) {
+                lcode_emit(c, OP_LOCAL);
+                lcode_emit(c, slot);
+            } else {
+                lcode_emit(c, OP_LOOKUP);
+            }
+            lcode_emit(c, lcode_const(c, x));
+            lcode_push(c, 1);
+            break;
+        }
+        case LVAL_SEXPR:
+            lcode_sexpr(c, x, formals, tail);
+            break;
+        default:
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, x));
+            lcode_push(c, 1);
+            break;
+    }
+}
+
+lcode* lcode_compile(lval* formals, lval* body) {
+    lcode* c = malloc(sizeof(lcode));
+    c->rc = 1;
+    c->count = 0;
+    c->ops = NULL;
+    c->nconsts = 0;
+    c->consts = NULL;
+    c->depth = 0;
+    c->max_stack = 0;
+
+    /* Frames can be built directly when every formal takes one argument */
+    c->nformals = formals->count;
+    c->syms = malloc(sizeof(char*) * formals->count);
+    c->simple = true;
+    for (int i = 0; i < formals->count; i++) {
+        c->syms[i] = formals->cell[i]->sym;
+        if (lval_slot(formals, c->syms[i]) != i) { c->simple = false; }
+    }
+
+    /* The body is evaluated as an S-expression */
+    lcode_sexpr(c, body, formals, true);
+    lcode_emit(c, OP_RETURN);
+    return c;
+}
+
+/* Drops a reference. Constants are only released when the collector is */
+/* not freeing them itself.                                              */
+void lcode_release(lcode* c, bool consts) {
+    if (--c->rc > 0) { return; }
+    if (consts) {
+        for (int i = 0; i < c->nconsts; i++) { lval_del(c->consts[i]); }
+    }
+    free(c->consts);
+    free(c->ops);
+    free(c->syms);
+    free(c);
+}
+
+void lcode_del(lcode* c) {
+    lcode_release(c, true);
+}
+
+/* The operand stack is shared by all running code and grows on demand */
+lval** lvm_stack = NULL;
+int lvm_sp = 0;
+int lvm_cap = 0;
+
+void lvm_reserve(int n) {
+    if (lvm_sp + n <= lvm_cap) { return; }
+    while (lvm_sp + n > lvm_cap) { lvm_cap = lvm_cap ? lvm_cap * 2 : 256; }
+    lvm_stack = realloc(lvm_stack, sizeof(lval*) * lvm_cap);
+}
+
+/* Can the top n values be called as f with a frame built in place? */
+bool lvm_direct(lval** v, int n) {
+    lval* f = v[0];
+    if (lval_type(f) != LVAL_FUN || f->builtin || !f->code || !f->code->simple
+        || f->count || f->code->nformals != n - 1) { return false; }
+
+    for (int i = 1; i < n; i++) {
+        if (lval_type(v[i]) == LVAL_ERR) { return false; }
+    }
+    return true;
+}
+
+/* Builtin calls with up to LVM_ARGS arguments and no errors among them */
+/* skip building an S-expression                                        */
+#define LVM_ARGS 8
+
+bool lvm_builtin(lval** v, int n) {
+    if (lval_type(v[0]) != LVAL_FUN || !v[0]->builtin || n < 2 || n - 1 > LVM_ARGS) { return false; }
+
+    for (int i = 1; i < n; i++) {
+        if (lval_type(v[i]) == LVAL_ERR) { return false; }
+    }
+    return true;
+}
+
+/* Moves the arguments into a new frame for f */
+lenv* lvm_frame(lenv* parent, lval* f, lval** args) {
+    lenv* e = lenv_new();
+    int n = f->code->nformals;
+    e->parent = parent;
+    e->count = n;
+    e->syms = malloc(sizeof(char*) * n);
+    e->vals = malloc(sizeof(lval*) * n);
+    memcpy(e->syms, f->code->syms, sizeof(char*) * n);
+    memcpy(e->vals, args, sizeof(lval*) * n);
+    for (int i = 0; i < n; i++) { lenv_link(e, e->syms[i], i); }
+    return e;
+}
+
+/* Can the top n values be called as a compiled lambda through lval_frame? */
+bool lvm_lambda(lval** v, int n) {
+    if (lval_type(v[0]) != LVAL_FUN || v[0]->builtin || !v[0]->code) { return false; }
+
+    for (int i = 1; i < n; i++) {
+        if (lval_type(v[i]) == LVAL_ERR) { return false; }
+    }
+    return true;
+}
+
+/* Runs the code of f in frame e. When own is set the run holds a */
+/* reference to f and owns e, and releases both when it returns.  */
+/*                                                                */
+/* A tail call to any compiled lambda runs in the same loop, and   */
+/* frames are dropped as in lval_eval_sexpr: the caller's when the */
+/* callee rebinds every name in it, and a held one once the frames */
+/* after it do, so deep tail recursion runs in constant space.     */
+lval* lcode_run(lenv* e, lval* f, bool own) {
+    lcode* c = f->code;
+    int* ops = c->ops;
+    lval** k = c->consts;
+    int pc = 0;
+    int n;
+    lenv** held = NULL;
+    int nheld = 0;
+
+    lvm_reserve(c->max_stack);
+
+#if LVAL_VM_THREADED
+    static void* labels[] = { &&L_OP_CONST, &&L_OP_LOCAL, &&L_OP_LOOKUP, &&L_OP_EMPTY,
+        &&L_OP_IF, &&L_OP_JUMP_FALSE, &&L_OP_JUMP, &&L_OP_CALL, &&L_OP_TAIL, &&L_OP_RETURN };
+    #define VM_CASE(op) L_##op
+    #define VM_NEXT goto *labels[ops[pc++]]
+    VM_NEXT;
+#else
+    #define VM_CASE(op) case op
+    #define VM_NEXT continue
+    for (;;) switch (ops[pc++]) {
+#endif
+
+    VM_CASE(OP_CONST):
+        lvm_stack[lvm_sp++] = lval_copy(k[ops[pc++]]);
+        VM_NEXT;
+
+    VM_CASE(OP_LOCAL): {
+        int i = ops[pc++];
+        lval* sym = k[ops[pc++]];
+        lvm_stack[lvm_sp++] = (i < e->count && e->syms[i] == sym->sym)
+            ? lval_copy(e->vals[i]) : lenv_get(e, sym);
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_LOOKUP):
+        lvm_stack[lvm_sp++] = lenv_get(e, k[ops[pc++]]);
+        VM_NEXT;
+
+    VM_CASE(OP_EMPTY):
+        lvm_stack[lvm_sp++] = lval_sexpr();
+        VM_NEXT;
+
+    VM_CASE(OP_IF): {
+        lval* x = lvm_stack[lvm_sp-1];
+        if (lval_type(x) == LVAL_FUN && x->builtin == builtin_if) {
+            lval_del(x);
+            lvm_sp--;
+            pc++;
+        } else {
+            pc = ops[pc];
+        }
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_JUMP_FALSE): {
+        lval* x = lvm_stack[--lvm_sp];
+        bool truth = lval_truth(x);
+        lval_del(x);
+        pc = truth ? pc + 1 : ops[pc];
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_JUMP):
+        pc = ops[pc];
+        VM_NEXT;
+
+    VM_CASE(OP_TAIL): {
+        n = ops[pc];
+        lval** v = &lvm_stack[lvm_sp-n];
+        lval* g = v[0];
+        lenv* frame;
+
+        if (lvm_direct(v, n)) {
+            frame = lvm_frame(e, g, v + 1);
+            lvm_sp -= n;
+        } else if (lvm_lambda(v, n)) {
+            /* Partial applications, '&' formals and the wrong number of */
+            /* arguments are bound the same way lval_call binds them     */
+            lval* s = lval_sexpr();
+            lval_reserve(s, n);
+            s->count = n;
+            memcpy(s->cell, v, sizeof(lval*) * n);
+            lvm_sp -= n;
+
+            lval* r;
+            frame = lval_frame(e, s, &r);
+            g = lval_copy(g);
+            lval_del(s);
+            if (!frame) {
+                lval_del(g);
+                lvm_stack[lvm_sp++] = r;
+                pc++;
+                VM_NEXT;
+            }
+        } else {
+            goto call;
+        }
+
+        if (lenv_shadows(frame, e)) {
+            frame->parent = e->parent;
+            if (own) { lenv_del(e); }
+        } else if (own) {
+            held = realloc(held, sizeof(lenv*) * (nheld + 1));
+            held[nheld++] = e;
+        }
+        if (nheld) { nheld = lenv_prune(frame, held, nheld); }
+        if (own) { lval_del(f); }
+
+        e = frame;
+        f = g;
+        own = true;
+
+        c = f->code;
+        ops = c->ops;
+        k = c->consts;
+        pc = 0;
+        lvm_reserve(c->max_stack);
+        VM_NEXT;
+    }
+
+    /* Anything else in tail position is an ordinary call */
+
+    VM_CASE(OP_CALL):
+    call: {
+        n = ops[pc++];
+        lvm_sp -= n;
+        lval** v = &lvm_stack[lvm_sp];
+        lval* x;
+
+        if (lvm_direct(v, n)) {
+            lval* g = v[0];
+            x = lcode_run(lvm_frame(e, g, v + 1), g, true);
+        } else if (lvm_builtin(v, n)) {
+            /* The builtin may run code that grows the stack, so it gets a copy */
+            lval* g = v[0];
+            lval* args[LVM_ARGS];
+            memcpy(args, v + 1, sizeof(lval*) * (n - 1));
+            x = g->builtin(e, args, n - 1);
+
+            lval_del(g);
+            for (int i = 0; i < n - 1; i++) { lval_del(args[i]); }
+        } else {
+            lval* s = lval_sexpr();
+            lval_reserve(s, n);
+            s->count = n;
+            memcpy(s->cell, v, sizeof(lval*) * n);
+            x = lval_apply(e, s);
+        }
+
+        lvm_stack[lvm_sp++] = x;
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_RETURN): {
+        lval* x = lvm_stack[--lvm_sp];
+        if (own) { lenv_del(e); lval_del(f); }
+        while (nheld) { lenv_del(held[--nheld]); }
+        free(held);
         return x;
     }
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    return v;
+
+#if !LVAL_VM_THREADED
+    }
+#endif
+    #undef VM_CASE
+    #undef VM_NEXT
 }
 
 /* Reading */
 
+/* Reads an integer too big for a long, nine digits at a time from the end */
+lval* lval_read_big(char* s) {
+    int sign = 1;
+    if (*s == '-') { sign = -1; s++; }
+
+    int len = strlen(s);
+    int n = (len + 8) / 9;
+    uint32_t* d = malloc(sizeof(uint32_t) * n);
+    for (int i = 0; i < n; i++) {
+        int end = len - 9 * i;
+        int start = end > 9 ? end - 9 : 0;
+        uint32_t x = 0;
+        for (int j = start; j < end; j++) { x = x * 10 + (s[j] - '0'); }
+        d[i] = x;
+    }
+    return lbig_result(d, n, sign);
+}
+
 lval* lval_read_num(mpc_ast_t* t) {
     errno = 0;
     long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number.");
+    return errno != ERANGE ? lval_num(x) : lval_read_big(t->contents);
+}
+
+lval* lval_read_dbl(mpc_ast_t* t) {
+    return lval_dbl(strtod(t->contents, NULL));
 }
 
 lval* lval_read_str(mpc_ast_t* t) {
@@ -1184,11 +4004,12 @@ lval* lval_read_str(mpc_ast_t* t) {
   unescaped = mpcf_unescape(unescaped);
   lval* str = lval_str(unescaped);
   free(unescaped);
-  return str;
+  return lval_hcons(str);
 }
 
 
 lval* lval_read(mpc_ast_t* t) {
+    if (strstr(t->tag, "decimal")) { return lval_read_dbl(t); }
     if (strstr(t->tag, "number")) { return lval_read_num(t); }
     if (strstr(t->tag, "string")) { return lval_read_str(t); }
     if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
@@ -1208,7 +4029,7 @@ lval* lval_read(mpc_ast_t* t) {
         x = lval_add(x, lval_read(t->children[i]));
     }
     
-    return x;
+    return lval_type(x) == LVAL_QEXPR ? lval_hcons(x) : x;
 }
 
 /* Main */
@@ -1216,6 +4037,7 @@ lval* lval_read(mpc_ast_t* t) {
 int main(int argc, char** argv) {
     
     Number = mpc_new("number");
+    Decimal = mpc_new("decimal");
     Symbol = mpc_new("symbol");
     String = mpc_new("string");
     Comment = mpc_new("comment");
@@ -1226,19 +4048,24 @@ int main(int argc, char** argv) {
     
     mpca_lang(MPCA_LANG_DEFAULT,
         "                                                                              \
+            decimal : /-?[0-9]+(\\.[0-9]+([eE][-+]?[0-9]+)?|[eE][-+]?[0-9]+)/ ;        \
             number  : /-?[0-9]+/ ;                                                     \
             symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&?]+/ ;                              \
             string  : /'\\b[\\w-]+/ ;                                                       \
             comment : /;[^\\r\\n]*/ ;                                                  \
             sexpr   : '(' <expr>* ')' ;                                                \
             qexpr   : '{' <expr>* '}' ;                                                \
-            expr    : <number> | <symbol> | <string> | <comment> | <sexpr> | <qexpr> ; \
+            expr    : <decimal> | <number> | <symbol> | <string> | <comment>           \
+                    | <sexpr> | <qexpr> ;                                              \
             lispy   : /^/ <expr>* /$/ ;                                                \
         ",
-        Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+        Number, Decimal, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+    lsym_amp = lsym_intern("&");
 
     lenv* e = lenv_new();
     lenv_add_builtins(e);
+    gc_env = e;
 
     mpc_result_t first;
     mpc_parse("<stdin>", "(func {def} (lambda {args body} {func (list (first args)) (lambda (rest args) body)}))", Lispy, &first);
@@ -1257,9 +4084,11 @@ int main(int argc, char** argv) {
             
             mpc_result_t r;
             if (mpc_parse("<stdin>", input, Lispy, &r)) {
+                gc_enter();
                 lval* x = lval_eval(e, lval_read(r.output));
                 lval_println(x);
                 lval_del(x);
+                gc_leave();
                 mpc_ast_delete(r.output);
             } else {        
                 mpc_err_print(r.error);
@@ -1278,9 +4107,10 @@ int main(int argc, char** argv) {
             extension = false;
             for (int j=0; j < strlen(argv[i]); j++) {
                 if (strcmp((argv[i] + j), ".minlsp") == 0) {
-                    lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-                    lval* x = builtin_load(e, args);
-                    if (x->type == LVAL_ERR) { lval_println(x); }
+                    lval* file = lval_str(argv[i]);
+                    lval* x = builtin_load(e, &file, 1);
+                    lval_del(file);
+                    if (lval_type(x) == LVAL_ERR) { lval_println(x); }
                     lval_del(x);
                     extension = true;
                     break;
@@ -1294,7 +4124,7 @@ int main(int argc, char** argv) {
 
     lenv_del(e);
     
-    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    mpc_cleanup(9, Number, Decimal, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
     
     return 0;
 }
\ No newline at end of file